@@ -0,0 +1,167 @@
+#include "threadPool.hpp"
+
+// which pool the current thread works for (if any), and its queue in that pool
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local uint32 currentQueueIndex = 0;
+
+ThreadPool::ThreadPool( uint32 numThreads ) :
+	numQueuedTasks( 0 ), isShuttingDown( false )
+{
+	if (numThreads == 0)
+	{
+		uint32 numCores = std::thread::hardware_concurrency();
+		numThreads = numCores > 1 ? numCores - 1 : 0;
+	}
+
+	// every queue has to exist before the workers start stealing from them
+	for (uint32 i = 0; i < numThreads + 1; i++)
+	{
+		queues.push_back( new WorkQueue() );
+	}
+	for (uint32 i = 0; i < numThreads; i++)
+	{
+		threads.push_back( std::thread( &ThreadPool::workerLoop, this, i ) );
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock( sleepMutex );
+		isShuttingDown = true;
+	}
+	taskAvailable.notify_all();
+
+	for (uint32 i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	for (uint32 i = 0; i < queues.size(); i++)
+	{
+		delete queues[i];
+	}
+}
+
+void ThreadPool::addTask( const Task &task, TaskGroup &group )
+{
+	QueuedTask queuedTask;
+	queuedTask.task = task;
+	queuedTask.group = &group;
+	group.numUnfinishedTasks++;
+
+	WorkQueue *queue = queues[getQueueIndex()];
+	{
+		std::unique_lock<std::mutex> lock( queue->mutex );
+		queue->tasks.push_back( queuedTask );
+	}
+	numQueuedTasks++;
+
+	// take the sleep lock so a thread can't miss the wake up between checking for tasks and sleeping
+	std::unique_lock<std::mutex> lock( sleepMutex );
+	taskAvailable.notify_one();
+	groupFinished.notify_all();		// waiting threads help out too
+}
+
+void ThreadPool::waitForTasks( TaskGroup &group )
+{
+	uint32 queueIndex = getQueueIndex();
+	QueuedTask task;
+	while (group.numUnfinishedTasks > 0)
+	{
+		if (getTask( queueIndex, task ))
+		{
+			runTask( task );
+			continue;
+		}
+
+		// the rest of the group is running on other threads
+		std::unique_lock<std::mutex> lock( sleepMutex );
+		while (group.numUnfinishedTasks > 0 && numQueuedTasks == 0)
+		{
+			groupFinished.wait( lock );
+		}
+	}
+}
+
+void ThreadPool::workerLoop( uint32 queueIndex )
+{
+	currentPool = this;
+	currentQueueIndex = queueIndex;
+
+	QueuedTask task;
+	while (true)
+	{
+		if (getTask( queueIndex, task ))
+		{
+			runTask( task );
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock( sleepMutex );
+		while (numQueuedTasks == 0 && !isShuttingDown)
+		{
+			taskAvailable.wait( lock );
+		}
+		if (isShuttingDown)
+		{
+			return;
+		}
+	}
+}
+
+//
+// workers use their own queue, every other thread uses the shared one at the end
+//
+uint32 ThreadPool::getQueueIndex() const
+{
+	return currentPool == this ? currentQueueIndex : (uint32)queues.size() - 1;
+}
+
+//
+// Take the newest task from our own queue, or steal the oldest task from another queue
+//
+bool ThreadPool::getTask( uint32 queueIndex, QueuedTask &task )
+{
+	if (numQueuedTasks == 0)
+	{
+		return false;
+	}
+
+	for (uint32 i = 0; i < queues.size(); i++)
+	{
+		uint32 index = (queueIndex + i) % queues.size();
+		WorkQueue *queue = queues[index];
+		std::unique_lock<std::mutex> lock( queue->mutex );
+		if (queue->tasks.empty())
+		{
+			continue;
+		}
+
+		if (index == queueIndex)
+		{
+			task = queue->tasks.back();
+			queue->tasks.pop_back();
+		}
+		else
+		{
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+		}
+		numQueuedTasks--;
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::runTask( QueuedTask &task )
+{
+	task.task();
+	task.task = nullptr;
+
+	if (--task.group->numUnfinishedTasks == 0)
+	{
+		std::unique_lock<std::mutex> lock( sleepMutex );
+		groupFinished.notify_all();
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include "common.hpp"
+#include "dataStructures/array.hpp"
+
+//
+// A fixed set of worker threads with a work stealing scheduler.
+// Every worker has its own task queue: tasks a worker adds go on its own queue and it runs
+// the newest first (they're the ones still in cache), while idle workers steal the oldest
+// tasks from the other queues.  Tasks added from other threads go on a shared queue.
+//
+// A thread which waits for tasks helps run them, so a pool with no workers still works
+// (it just runs everything on the waiting thread), and tasks can wait for tasks of their own.
+//
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	// counts the unfinished tasks added with it, so a thread can wait for just those tasks
+	class TaskGroup
+	{
+	public:
+		TaskGroup() : numUnfinishedTasks( 0 ) {}
+	private:
+		friend class ThreadPool;
+		std::atomic<uint32> numUnfinishedTasks;
+	};
+
+	// numThreads = 0 uses one worker per core, minus one for the thread that waits
+	explicit ThreadPool( uint32 numThreads = 0 );
+	~ThreadPool();
+
+	// tasks may add more tasks while they run
+	void addTask( const Task &task ) { addTask( task, defaultGroup ); }
+	void addTask( const Task &task, TaskGroup &group );
+
+	// runs tasks on the calling thread until every task in the group (including any added while
+	// waiting) is done
+	void waitForTasks() { waitForTasks( defaultGroup ); }
+	void waitForTasks( TaskGroup &group );
+
+	uint32 getNumThreads() const { return (uint32)threads.size(); }
+
+private:
+	struct QueuedTask
+	{
+		Task task;
+		TaskGroup *group;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<QueuedTask> tasks;
+	};
+
+	Array<std::thread> threads;
+	Array<WorkQueue*> queues;		// one per worker, the last one is shared by all other threads
+	TaskGroup defaultGroup;
+	std::atomic<uint32> numQueuedTasks;
+	bool isShuttingDown;
+
+	// idle threads sleep on these
+	std::mutex sleepMutex;
+	std::condition_variable taskAvailable;
+	std::condition_variable groupFinished;
+
+	void workerLoop( uint32 queueIndex );
+	uint32 getQueueIndex() const;
+	bool getTask( uint32 queueIndex, QueuedTask &task );
+	void runTask( QueuedTask &task );
+
+	NULL_COPY_AND_ASSIGN( ThreadPool );
+};
@@ -1,372 +1,1082 @@
+#include <algorithm>
 #include "core/memory.hpp"
+#include "core/timing.hpp"
 #include "math/math.hpp"
 #include "ecs.hpp"
 #include "ecsSystem.hpp"
 
+#define ECS_DEFRAGMENT_STEPS_PER_TIME_CHECK 64	// rows sorted between looking at the clock
+
 ECS::~ECS()
 {
-	// loop thru all component lists (organized by component ID)
-	for (Map<uint32, ComponentBlock>::iterator it = components.begin(); it != components.end(); it++)
+	// deleting the archetypes frees all the components they hold
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{
+		delete archetypes[i];
+	}
+	for (uint32 i = 0; i < queries.size(); i++)
 	{
-		// prepare to free all components in that list
-		// they are all the same kind, so same ID, freeFunc and size
-		uint32 componentID = it->first;
-		size_t typeSize = BaseECSComponent::getTypeSize( componentID );
-		ECSComponentFreeFunc freefn = BaseECSComponent::getTypeFreeFunction( componentID );
+		delete queries[i];
+	}
+	for (uint32 i = 0; i < singletons.size(); i++)
+	{
+		removeSingletonByType( i );
+	}
+}
 
-		// go thru all components in the list and free them
-		ComponentBlock &componentList = it->second;
-		for (uint32 i = 0; i < componentList.size(); i += typeSize)
+//
+// Take a slot from the free list (or grow the slot map) and return a handle to it
+//
+EntityHandle ECS::allocateEntity()
+{
+	uint32 index;
+	if (freeEntityList != NULL_ENTITY_HANDLE)
+	{
+		index = freeEntityList;
+		freeEntityList = entities[index].row;
+	}
+	else
+	{
+		index = entities.size();
+		if (index >= ECS_ENTITY_INDEX_MASK)	// the last index is reserved for NULL_ENTITY_HANDLE
 		{
-			freefn( reinterpret_cast<BaseECSComponent*>(&componentList[i]) );
+			DEBUG_LOG( "ECS", LOG_ERROR, "out of entity slots" );
+			return NULL_ENTITY_HANDLE;
 		}
+		EntityRecord newRecord;
+		newRecord.generation = 0;
+		entities.push_back( newRecord );
 	}
 
-	// delete all entities
-	for (uint32 i = 0; i < entities.size(); i++)
-	{
-		delete entities[i];
-	}
+	numEntities++;
+	return makeHandle( index, entities[index].generation );
 }
 
 //
-// Creates an entity along with the components it needs and add it to the entities list.
-// Returns a pointer to the entity
+// Put the slot back on the free list, bumping the generation invalidates any handles still pointing at it
+//
+void ECS::freeEntity( EntityHandle handle )
+{
+	uint32 index = handleToIndex( handle );
+	EntityRecord &entity = entities[index];
+	entity.archetype = nullptr;
+	entity.generation = (entity.generation + 1) & ECS_ENTITY_GENERATION_MASK;
+	entity.row = freeEntityList;
+	freeEntityList = index;
+	numEntities--;
+}
+
+//
+// Creates an entity along with the components it needs and gives it a slot in the entities list.
+// Returns a handle to the entity
 //
 EntityHandle ECS::makeEntity( BaseECSComponent **entityComponents, const uint32 *componentIDs,
 	size_t numComponents )
 {
-	// create a new entity
-	std::pair<uint32, EntityType> *newEntity = new std::pair<uint32 /*index*/, EntityType>();
-	EntityHandle handle = static_cast<EntityHandle>(newEntity);
+	EntityHandle handle = NULL_ENTITY_HANDLE;
+	makeEntities( 1, entityComponents, componentIDs, numComponents, &handle );
+	return handle;
+}
 
-	// create the components (if valid) and add them to the entity
+//
+// Every new entity goes into the same archetype, so the component types are checked, the archetype
+// is found and the listeners are matched once for the whole batch.
+// Returns the number of entities made, which is only less than count if we ran out of entity slots
+//
+uint32 ECS::makeEntities( uint32 count, BaseECSComponent **prototypes, const uint32 *componentIDs,
+	size_t numComponents, EntityHandle *handlesOut, const EntityInitializer &initializer )
+{
+	// check the component ids and sort them, the archetype is keyed by the sorted list
+	Array<uint32> &sortedIDs = scratchIDs;
+	sortedIDs.clear();
 	for (uint32 i = 0; i < numComponents; i++)
 	{
 		// check if component id is valid
 		if (!BaseECSComponent::isTypeValid( componentIDs[i] ))
 		{
 			DEBUG_LOG( "ECS", LOG_ERROR, "%u is not a valid component type", componentIDs[i] );
-			delete newEntity;
-			return NULL_ENTITY_HANDLE;
+			return 0;
 		}
+		sortedIDs.push_back( componentIDs[i] );
+	}
+	std::sort( sortedIDs.begin(), sortedIDs.end() );
+	for (uint32 i = 1; i < sortedIDs.size(); i++)
+	{
+		if (sortedIDs[i] == sortedIDs[i - 1])
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "entity has more than one component of type %u", sortedIDs[i] );
+			return 0;
+		}
+	}
+
+	// make room for all of them up front (reserving exactly one more each time would stop the arrays growing geometrically)
+	ECSArchetype *archetype = findOrCreateArchetype( sortedIDs );
+	if (count > 1)
+	{
+		archetype->reserve( archetype->getNumEntities() + count );
+		entities.reserve( entities.size() + count );
+	}
 
-		// add each components to the entity
-		addComponentInternal( handle, newEntity->second, componentIDs[i], entityComponents[i] );
+	// SoA components don't exist as whole components in the archetype, so the initializer
+	// gets a copy of each of them to fill in, which is then split up into the field streams
+	Array<BaseECSComponent*> newComponents( numComponents );
+	Array<int32> columns( numComponents );
+	Array<size_t> soaOffsets( numComponents );
+	size_t soaSize = 0;
+	for (uint32 i = 0; i < numComponents; i++)
+	{
+		columns[i] = archetype->getColumnIndex( componentIDs[i] );
+		if (archetype->isSoAColumn( columns[i] ))
+		{
+			soaOffsets[i] = soaSize = Memory::align( soaSize, BaseECSComponent::getTypeAlignment( componentIDs[i] ) );
+			soaSize += BaseECSComponent::getTypeSize( componentIDs[i] );
+		}
 	}
+	Array<uint8> soaComponents( soaSize );
 
-	// add the entity to the ECS entities list
-	newEntity->first = entities.size();
-	entities.push_back( newEntity );
+	Array<EntityHandle> newHandles;
+	if (handlesOut == nullptr)
+	{
+		newHandles.resize( count );
+		handlesOut = newHandles.data();
+	}
 
-	// notify any listeners if this entity has ALL the components they care about
-	for (uint32 i = 0; i < listeners.size(); i++)
+	uint32 numMade = 0;
+	for (; numMade < count; numMade++)
 	{
-		bool isValid = true;
-		for (uint32 j = 0; j < listeners[i]->getComponentIDs().size(); j++)
+		// create a new entity
+		EntityHandle handle = allocateEntity();
+		if (handle == NULL_ENTITY_HANDLE)
+		{
+			break;
+		}
+		EntityRecord *newEntity = &entities[handleToIndex( handle )];
+		newEntity->archetype = archetype;
+		newEntity->row = archetype->addRow( handle );
+
+		// create the components in their archetype columns
+		for (uint32 i = 0; i < numComponents; i++)
 		{
-			// check if the entity has this component
-			bool hasComponent = false;
-			for (uint32 k = 0; k < numComponents; k++)
+			if (initializer && archetype->isSoAColumn( columns[i] ))
 			{
-				if (listeners[i]->getComponentIDs()[j] == componentIDs[k])
-				{
-					hasComponent = true;
-					break;
-				}
+				newComponents[i] = (BaseECSComponent*)&soaComponents[soaOffsets[i]];
+				Memory::memcpy( newComponents[i], prototypes[i], BaseECSComponent::getTypeSize( componentIDs[i] ) );
+				newComponents[i]->entity = handle;
+				continue;
 			}
-			if (!hasComponent)
+			archetype->createComponent( newEntity->row, columns[i], handle, /* the entity to point back to */
+				prototypes[i] /* the component template to copy */ );
+			if (initializer)
 			{
-				isValid = false;	// this entity doesn't have the component so skip it
-				break;
+				newComponents[i] = archetype->getComponent( newEntity->row, columns[i] );	/* the slot in the chunk */
 			}
 		}
-		if (isValid)
+		if (initializer)
 		{
-			listeners[i]->onMakeEntity(handle);
+			initializer( numMade, handle, newComponents.data() );
+			for (uint32 i = 0; i < numComponents; i++)
+			{
+				if (archetype->isSoAColumn( columns[i] ))
+				{
+					archetype->writeComponent( newEntity->row, columns[i], newComponents[i] );
+				}
+			}
 		}
+		handlesOut[numMade] = handle;
+	}
+	for (uint32 i = numMade; i < count; i++)
+	{
+		handlesOut[i] = NULL_ENTITY_HANDLE;
 	}
 
-	return handle;
+	// notify any listeners if the entities have ALL the components they care about
+	const Array<uint32> &interested = archetypeListeners[archetype->getIndex()];
+	for (uint32 i = 0; i < interested.size() && numMade > 0; i++)
+	{
+		listeners[interested[i]]->onMakeEntities( handlesOut, numMade );
+	}
+
+	return numMade;
 }
 
 //
-// Remove an entity by removing all of its components and then removing it from the entities list
+// All the slots are taken first, so the rows can be added and every column filled a chunk at a time.
+// Only the components the initializer asks for are handed out one entity at a time
 //
-void ECS::removeEntity( EntityHandle handle )
+uint32 ECS::instantiate( const ECSPrefab &prefab, uint32 count, EntityHandle *handlesOut,
+	const uint32 *initializerIDs, size_t numInitializerIDs, const EntityInitializer &initializer )
 {
-	EntityType& entity = handleToEntity( handle );
+	if (!prefab.isValid())
+	{
+		return 0;
+	}
+	Array<int32> columns( numInitializerIDs );
+	for (uint32 i = 0; i < numInitializerIDs; i++)
+	{
+		columns[i] = prefab.getColumnIndex( initializerIDs[i] );
+		if (columns[i] < 0)
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "the prefab doesn't have component type %u", initializerIDs[i] );
+			return 0;
+		}
+	}
 
-	// notify any listeners if this entity has ALL the components they care about
-	for (uint32 i = 0; i < listeners.size(); i++)
+	ECSArchetype *archetype = findOrCreateArchetype( prefab.getComponentIDs() );
+	archetype->reserve( archetype->getNumEntities() + count );
+	entities.reserve( entities.size() + count );
+
+	Array<EntityHandle> newHandles;
+	if (handlesOut == nullptr)
+	{
+		newHandles.resize( count );
+		handlesOut = newHandles.data();
+	}
+	uint32 numMade = 0;
+	for (; numMade < count; numMade++)
+	{
+		handlesOut[numMade] = allocateEntity();
+		if (handlesOut[numMade] == NULL_ENTITY_HANDLE)
+		{
+			break;
+		}
+	}
+	for (uint32 i = numMade; i < count; i++)
+	{
+		handlesOut[i] = NULL_ENTITY_HANDLE;
+	}
+
+	uint32 firstRow = archetype->addRows( handlesOut, numMade );
+	for (uint32 i = 0; i < numMade; i++)
+	{
+		EntityRecord &newEntity = entities[handleToIndex( handlesOut[i] )];
+		newEntity.archetype = archetype;
+		newEntity.row = firstRow + i;
+	}
+	for (uint32 i = 0; i < prefab.getComponentIDs().size(); i++)
+	{
+		archetype->fillComponents( firstRow, numMade, i, prefab.getComponent( i ) );
+	}
+
+	if (initializer && numMade > 0)
 	{
-		const Array<uint32> &componentIDs = listeners[i]->getComponentIDs();
-		bool isValid = true;
-		for (uint32 j = 0; j < componentIDs.size(); j++)
+		// SoA components are handed out as whole copies, and split back up into their streams afterwards
+		Array<BaseECSComponent*> newComponents( numInitializerIDs );
+		Array<size_t> soaOffsets( numInitializerIDs );
+		size_t soaSize = 0;
+		for (uint32 i = 0; i < numInitializerIDs; i++)
+		{
+			if (archetype->isSoAColumn( columns[i] ))
+			{
+				soaOffsets[i] = soaSize = Memory::align( soaSize, BaseECSComponent::getTypeAlignment( initializerIDs[i] ) );
+				soaSize += BaseECSComponent::getTypeSize( initializerIDs[i] );
+			}
+		}
+		Array<uint8> soaComponents( soaSize );
+
+		for (uint32 i = 0; i < numMade; i++)
 		{
-			// check if the entity has this component
-			bool hasComponent = false;
-			for (uint32 k = 0; k < entity.size(); k++)
+			uint32 row = firstRow + i;
+			for (uint32 j = 0; j < numInitializerIDs; j++)
 			{
-				if (componentIDs[j] == entity[k].first)
+				if (archetype->isSoAColumn( columns[j] ))
 				{
-					hasComponent = true;
-					break;
+					newComponents[j] = (BaseECSComponent*)&soaComponents[soaOffsets[j]];
+					Memory::memcpy( newComponents[j], prefab.getComponent( columns[j] ),
+						BaseECSComponent::getTypeSize( initializerIDs[j] ) );
+					newComponents[j]->entity = handlesOut[i];
+					continue;
 				}
+				newComponents[j] = archetype->getComponent( row, columns[j] );
 			}
-			if (!hasComponent)
+			initializer( i, handlesOut[i], newComponents.data() );
+			for (uint32 j = 0; j < numInitializerIDs; j++)
 			{
-				isValid = false;	// this entity doesn't have the component so skip it
-				break;
+				if (archetype->isSoAColumn( columns[j] ))
+				{
+					archetype->writeComponent( row, columns[j], newComponents[j] );
+				}
 			}
 		}
-		if (isValid)
-		{
-			listeners[i]->onRemoveEntity(handle);
-		}
 	}
 
-	for (uint32 i = 0; i < entity.size(); i++)
+	// one notification for the whole lot
+	const Array<uint32> &interested = archetypeListeners[archetype->getIndex()];
+	for (uint32 i = 0; i < interested.size() && numMade > 0; i++)
 	{
+		listeners[interested[i]]->onMakeEntities( handlesOut, numMade );
+	}
 
+	return numMade;
+}
+
+//
+// Remove an entity by removing its row (and components) from its archetype and then freeing its slot
+//
+void ECS::removeEntity( EntityHandle handle )
+{
+	EntityRecord *entity = handleToRecord( handle );
+	if (entity == nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_WARNING, "removing an entity which no longer exists" );
+		return;
 	}
 
-	// remove all of its components
-	for (uint32 i = 0; i < entity.size(); i++)
+	notifyRemoveEntities( &handle, 1, entity->archetype );
+
+	// remove all of its components, the last entity in the archetype moves into its row
+	EntityHandle movedEntity = entity->archetype->removeRow( entity->row, true );
+	if (movedEntity != NULL_ENTITY_HANDLE)
 	{
-		deleteComponent( entity[i].first /* componentID */,
-			entity[i].second /* index of component in the components map list */ );
+		entities[handleToIndex( movedEntity )].row = entity->row;
 	}
 
-	// remove the entity from the entities list by swapping it with the last one
-	uint32 entityIndex = handleToEntityIndex( handle );
-	uint32 lastIndex = entities.size() - 1;
-	delete entities[entityIndex];	// delete the one we're removing
-	entities[entityIndex] = entities[lastIndex];	// replace it with the one at the end
-	entities[entityIndex]->first = entityIndex;		// update it's index as well
-	entities.pop_back();	// now delete the one at the end (which is now  duplicate)
+	// release the slot so it can be reused
+	freeEntity( handle );
 }
 
-void ECS::addComponentInternal( EntityHandle handle, EntityType &entity, uint32 componentID, BaseECSComponent *component )
+//
+// Remove a batch of entities.  Sorting them by archetype and then by row from last to first means
+// the row moved into a removed entity's place is never one that still has to be removed,
+// so rows don't have to be looked up again as the archetype shrinks.
+//
+void ECS::removeEntities( const EntityHandle *handles, size_t numHandles )
 {
-	// get the component create func
-	ECSComponentCreateFunc createfn = BaseECSComponent::getTypeCreateFunction( componentID );
+	Array<std::pair<EntityRecord*, EntityHandle>> removed;
+	removed.reserve( numHandles );
+	for (size_t i = 0; i < numHandles; i++)
+	{
+		EntityRecord *entity = handleToRecord( handles[i] );
+		if (entity != nullptr)
+		{
+			removed.push_back( std::make_pair( entity, handles[i] ) );
+		}
+	}
 
-	// Create the component pair which consists of componentID and it's index in the component list,
-	// which is part of the ECS components map.
-	std::pair<uint32, uint32> newPair;
-	newPair.first = componentID;
-	newPair.second = createfn( components[componentID], /* the components list (memory block from map) */
-		handle, /* the entity to point back to */
-		component /* the component template to copy */ );
+	std::sort( removed.begin(), removed.end(),
+		[]( const std::pair<EntityRecord*, EntityHandle> &a, const std::pair<EntityRecord*, EntityHandle> &b )
+	{
+		if (a.first->archetype != b.first->archetype)
+		{
+			return a.first->archetype->getIndex() < b.first->archetype->getIndex();
+		}
+		return a.first->row > b.first->row;
+	} );
+	removed.erase( std::unique( removed.begin(), removed.end() ), removed.end() );	// removed twice
 
-	// add component pair to the entity
-	entity.push_back( newPair );
+	// each archetype's entities go together, so its listeners can be told about them all at once
+	Array<EntityHandle> archetypeHandles;
+	for (uint32 start = 0, end = 0; start < removed.size(); start = end)
+	{
+		ECSArchetype *archetype = removed[start].first->archetype;
+		archetypeHandles.clear();
+		for (end = start; end < removed.size() && removed[end].first->archetype == archetype; end++)
+		{
+			archetypeHandles.push_back( removed[end].second );
+		}
+		notifyRemoveEntities( archetypeHandles.data(), archetypeHandles.size(), archetype );
+
+		for (uint32 i = start; i < end; i++)
+		{
+			EntityRecord *entity = removed[i].first;
+			EntityHandle movedEntity = archetype->removeRow( entity->row, true );
+			if (movedEntity != NULL_ENTITY_HANDLE)
+			{
+				entities[handleToIndex( movedEntity )].row = entity->row;
+			}
+			freeEntity( removed[i].second );
+		}
+	}
 }
 
 //
-// Delete the specified component from the ECS component list.
-// find the component and call its free function on it, 
-// then swap it with the last one in the list.  Since we moved the last component in the list 
-// we need to find the entity that it was attached to and update it's component list to reflect 
-// the new index.
+// Listeners are told about entity changes if the entity has ALL the components they care about.
+// That only depends on the archetype, so each archetype keeps a list of its listeners
 //
-void ECS::deleteComponent( uint32 componentID, uint32 index )
+void ECS::notifyRemoveEntities( const EntityHandle *handles, size_t numHandles, ECSArchetype *archetype )
 {
-	ComponentBlock &array = components[componentID];		// get list of components of the right type
-	ECSComponentFreeFunc freefn = BaseECSComponent::getTypeFreeFunction( componentID );
-	size_t typeSize = BaseECSComponent::getTypeSize( componentID );
-	uint32 srcIndex = array.size() - typeSize;			// get index of the last element
-	BaseECSComponent *destComponent = (BaseECSComponent*)&array[index];
-	BaseECSComponent *srcComponent = (BaseECSComponent*)&array[srcIndex];
-	freefn( destComponent );
+	const Array<uint32> &interested = archetypeListeners[archetype->getIndex()];
+	for (uint32 i = 0; i < interested.size(); i++)
+	{
+		listeners[interested[i]]->onRemoveEntities( handles, numHandles );
+	}
+}
 
-	if (index == srcIndex)
-	{	// special case when deleting the last item, don't need to move any components
-		array.resize( srcIndex );
+//
+// notify the listeners who care about this type of component
+//
+void ECS::notifyComponentChange( EntityHandle handle, uint32 componentID, bool isAdded )
+{
+	if (componentID >= componentListeners.size())
+	{
 		return;
 	}
 
-	// copy the last component over this one (swap places in the list)
-	Memory::memcpy( destComponent, srcComponent, typeSize );
+	const Array<uint32> &interested = componentListeners[componentID];
+	for (uint32 i = 0; i < interested.size(); i++)
+	{
+		if (isAdded)
+		{
+			listeners[interested[i]]->onAddComponent( handle, componentID );
+		}
+		else
+		{
+			listeners[interested[i]]->onRemoveComponent( handle, componentID );
+		}
+	}
+}
 
-	// find the update the entity that was pointing to the last component, since we moved it
-	EntityType &srcComponents = handleToEntity( srcComponent->entity );
-	for (uint32 i = 0; i < srcComponents.size(); i++)
+//
+// Index the listener by its component types, and by the archetypes it wants to hear about
+//
+void ECS::addListener( ECSListener *listener )
+{
+	uint32 listenerIndex = (uint32)listeners.size();
+	listeners.push_back( listener );
+
+	ECSComponentMask mask;
+	const Array<uint32> &componentIDs = listener->getComponentIDs();
+	for (uint32 i = 0; i < componentIDs.size(); i++)
 	{
-		if (componentID == srcComponents[i].first && srcIndex == srcComponents[i].second)
+		mask.set( componentIDs[i] );
+		if (componentIDs[i] >= componentListeners.size())
 		{
-			srcComponents[i].second = index;
-			break;
+			componentListeners.resize( componentIDs[i] + 1 );
 		}
+		componentListeners[componentIDs[i]].push_back( listenerIndex );
 	}
+	listenerMasks.push_back( mask );
 
-	array.resize( srcIndex );
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{
+		if (archetypes[i]->getMask().contains( mask ))
+		{
+			archetypeListeners[i].push_back( listenerIndex );
+		}
+	}
 }
 
 //
-// Remove the component from the entity, return true on success
+// Copy a component out of the entity, whatever its layout
 //
-bool ECS::removeComponentInternal( EntityHandle handle, uint32 componentID )
+bool ECS::readComponentByType( EntityHandle handle, uint32 componentID, BaseECSComponent *component )
 {
-	// find the component on the entity
-	EntityType &entityComponents = handleToEntity( handle );
-	for (uint32 i = 0; i < entityComponents.size(); i++)
+	EntityRecord *entity = handleToRecord( handle );
+	int32 column = entity != nullptr ? entity->archetype->getColumnIndex( componentID ) : -1;
+	if (column < 0)
 	{
-		if (componentID == entityComponents[i].first)
-		{
-			// delete the component
-			deleteComponent( entityComponents[i].first, entityComponents[i].second );
+		return false;
+	}
 
-			// swap it with final element in the entity component array to remove it
-			uint32 srcIndex = entityComponents.size() - 1;
-			entityComponents[i] = entityComponents[srcIndex];
-			entityComponents.pop_back();	// remove end element
+	if (entity->archetype->isSoAColumn( column ))
+	{
+		entity->archetype->readComponent( entity->row, column, component );
+	}
+	else
+	{
+		Memory::memcpy( component, entity->archetype->getComponent( entity->row, column ),
+			BaseECSComponent::getTypeSize( componentID ) );
+	}
+	return true;
+}
 
-			return true;
-		}
+bool ECS::writeComponentByType( EntityHandle handle, uint32 componentID, const BaseECSComponent *component )
+{
+	EntityRecord *entity = handleToRecord( handle );
+	int32 column = entity != nullptr ? entity->archetype->getColumnIndex( componentID ) : -1;
+	if (column < 0)
+	{
+		return false;
 	}
 
-	return false;
+	if (entity->archetype->isSoAColumn( column ))
+	{
+		entity->archetype->writeComponent( entity->row, column, component );
+	}
+	else
+	{
+		Memory::memcpy( entity->archetype->getComponent( entity->row, column ), component,
+			BaseECSComponent::getTypeSize( componentID ) );
+		entity->archetype->getComponent( entity->row, column )->entity = handle;
+		entity->archetype->markChanged( entity->row, column );
+	}
+	return true;
+}
+
+bool ECS::markChangedByType( EntityHandle handle, uint32 componentID )
+{
+	EntityRecord *entity = handleToRecord( handle );
+	int32 column = entity != nullptr ? entity->archetype->getColumnIndex( componentID ) : -1;
+	if (column < 0)
+	{
+		return false;
+	}
+
+	entity->archetype->markChanged( entity->row, column );
+	return true;
+}
+
+uint32 ECS::getChangeVersionByType( EntityHandle handle, uint32 componentID )
+{
+	EntityRecord *entity = handleToRecord( handle );
+	int32 column = entity != nullptr ? entity->archetype->getColumnIndex( componentID ) : -1;
+	if (column < 0)
+	{
+		return 0;
+	}
+
+	ECSArchetype *archetype = entity->archetype;
+	return archetype->getColumnVersion( archetype->getChunk( entity->row / archetype->getChunkCapacity() ), column );
+}
+
+bool ECS::addComponentByType( EntityHandle handle, uint32 componentID, BaseECSComponent *component )
+{
+	if (!addComponentInternal( handle, componentID, component ))
+	{
+		return false;
+	}
+
+	notifyComponentChange( handle, componentID, true );
+	return true;
+}
+
+bool ECS::removeComponentByType( EntityHandle handle, uint32 componentID )
+{
+	if (!hasComponentByType( handle, componentID ))
+	{
+		return false;
+	}
+
+	// listeners get to see the component before it goes
+	notifyComponentChange( handle, componentID, false );
+	return removeComponentInternal( handle, componentID );
 }
 
 //
-// go thru all the components on an entity and return a pointer to the one with the matching componentID
+// Find the archetype for the (sorted) list of component types, create it if this is the first entity with that set
 //
-BaseECSComponent *ECS::getComponentInternal( EntityType &entityComponents, ComponentBlock &compBlock, uint32 componentID )
+ECSArchetype *ECS::findOrCreateArchetype( const Array<uint32> &componentIDs )
 {
-	for (uint32 i = 0; i < entityComponents.size(); i++)
+	Map<Array<uint32>, ECSArchetype*>::iterator it = archetypeMap.find( componentIDs );
+	if (it != archetypeMap.end())
 	{
-		if (componentID == entityComponents[i].first)
+		return it->second;
+	}
+
+	ECSArchetype *archetype = new ECSArchetype( componentIDs, doubleBuffered, (uint32)archetypes.size(),
+		chunkAllocator, changeVersion );
+	archetypeMap[componentIDs] = archetype;
+	archetypes.push_back( archetype );
+
+	archetypeListeners.push_back( Array<uint32>() );
+	for (uint32 i = 0; i < listeners.size(); i++)
+	{
+		if (archetype->getMask().contains( listenerMasks[i] ))
 		{
-			uint32 compIndex = entityComponents[i].second;
-			return (BaseECSComponent*)&compBlock[compIndex];
+			archetypeListeners.back().push_back( i );
 		}
 	}
 
-	return nullptr;
+	// the only time a query's archetypes change
+	for (uint32 i = 0; i < queries.size(); i++)
+	{
+		queries[i]->addArchetype( *archetype );
+	}
+	return archetype;
+}
+
+//
+// Move the entity into a different archetype (after a component was added or removed).
+// Components both archetypes share are moved across, the rest are freed.
+//
+void ECS::moveEntity( EntityHandle handle, ECSArchetype *dest )
+{
+	EntityRecord *entity = &entities[handleToIndex( handle )];
+	ECSArchetype *src = entity->archetype;
+	uint32 srcRow = entity->row;
+
+	uint32 destRow = dest->addRow( handle );
+	ECSArchetype::moveComponents( *src, srcRow, *dest, destRow );
+	EntityHandle movedEntity = src->removeRow( srcRow, false );
+	if (movedEntity != NULL_ENTITY_HANDLE)
+	{
+		entities[handleToIndex( movedEntity )].row = srcRow;
+	}
+
+	entity->archetype = dest;
+	entity->row = destRow;
+}
+
+//
+// Add the component by moving the entity into the archetype which also has that component type.
+// Returns false if the entity already had a component of that type
+//
+bool ECS::addComponentInternal( EntityHandle handle, uint32 componentID, BaseECSComponent *component )
+{
+	EntityRecord *entity = handleToRecord( handle );
+	if (entity == nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_WARNING, "adding a component to an entity which no longer exists" );
+		return false;
+	}
+	if (entity->archetype->hasComponent( componentID ))
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "entity already has a component of type %u", componentID );
+		return false;
+	}
+
+	Array<uint32> &newIDs = scratchIDs;
+	newIDs = entity->archetype->getComponentIDs();
+	newIDs.insert( std::upper_bound( newIDs.begin(), newIDs.end(), componentID ), componentID );
+	moveEntity( handle, findOrCreateArchetype( newIDs ) );
+
+	// create the new component in its column
+	entity->archetype->createComponent( entity->row, entity->archetype->getColumnIndex( componentID ),
+		handle, /* the entity to point back to */
+		component /* the component template to copy */ );
+	return true;
+}
+
+//
+// Remove the component from the entity by moving it into the archetype without that component type.
+// Return true on success
+//
+bool ECS::removeComponentInternal( EntityHandle handle, uint32 componentID )
+{
+	EntityRecord *entity = handleToRecord( handle );
+	if (entity == nullptr || !entity->archetype->hasComponent( componentID ))
+	{
+		return false;
+	}
+
+	Array<uint32> &newIDs = scratchIDs;
+	newIDs = entity->archetype->getComponentIDs();
+	newIDs.erase( std::find( newIDs.begin(), newIDs.end(), componentID ) );
+	moveEntity( handle, findOrCreateArchetype( newIDs ) );	// frees the removed component
+	return true;
+}
+
+//
+// Find the cached query for the component types and flags, creating it (and matching it against
+// every existing archetype) the first time it is asked for
+//
+ECSQuery &ECS::query( const Array<uint32> &componentTypes, const Array<uint32> &componentFlags )
+{
+	Array<uint32> &key = scratchQueryKey;
+	key.assign( componentTypes.begin(), componentTypes.end() );
+	key.insert( key.end(), componentFlags.begin(), componentFlags.end() );
+	Map<Array<uint32>, ECSQuery*>::iterator it = queryMap.find( key );
+	if (it != queryMap.end())
+	{
+		return *it->second;
+	}
+
+	ECSQuery *newQuery = new ECSQuery( componentTypes, componentFlags );
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{
+		newQuery->addArchetype( *archetypes[i] );
+	}
+	queryMap[key] = newQuery;
+	queries.push_back( newQuery );
+	return *newQuery;
 }
 
 void ECS::updateSystems( ECSSystemList &systems, float delta )
 {
-	Array <BaseECSComponent*> componentParam;
-	Array <ComponentBlock*> componentBlockArray;
 	for (uint32 i = 0; i < systems.size(); i++)
 	{
-		// get the array of component IDS that this system operates on
-		const Array<uint32> &componentTypes = systems[i]->getComponentTypes();
+		// go thru every archetype which has the components the system needs
+		SystemUpdate update;
+		update.system = systems[i];
+		update.query = &query( systems[i]->getComponentTypes(), systems[i]->getComponentFlags() );
+		update.version = advanceChangeVersion();
+		update.lastVersion = swapSystemVersion( *systems[i], update.version );
+		update.numDependencies = 0;
+		runSystemChunks( update, delta );
+	}
+}
 
-		// simple case
-		if (componentTypes.size() == 1)
+void ECS::updateSystems( ECSSystemList &systems, float delta, ThreadPool &threadPool )
+{
+	// find out what each system runs on, then build the dependency graph:
+	// a system waits for every earlier system that it conflicts with, so conflicting systems
+	// still run in list order
+	Array<SystemUpdate> updates( systems.size() );
+	for (uint32 i = 0; i < systems.size(); i++)
+	{
+		updates[i].system = systems[i];
+		updates[i].query = &query( systems[i]->getComponentTypes(), systems[i]->getComponentFlags() );
+		updates[i].version = advanceChangeVersion();
+		updates[i].lastVersion = swapSystemVersion( *systems[i], updates[i].version );
+		updates[i].numDependencies = 0;
+		for (uint32 j = 0; j < i; j++)
 		{
-			size_t typeSize = BaseECSComponent::getTypeSize( componentTypes[0] );
+			if (doSystemsConflict( updates[j], updates[i] ))
+			{
+				updates[j].dependents.push_back( i );
+				updates[i].numDependencies++;
+			}
+		}
+	}
+
+	// finishing a system starts any of its dependents which aren't waiting on anything else.
+	// Only this update's tasks go in the group, so other ECSs can be updated on the same pool at the
+	// same time (even from the pool's own tasks) without waiting for each other
+	ThreadPool::TaskGroup group;
+	std::mutex graphMutex;
+	std::function<void( uint32 )> runSystem = [&]( uint32 index )
+	{
+		runSystemUpdate( updates[index], delta, threadPool );
 
-			// get the list of components of that type (memory block)
-			ComponentBlock &array = components[componentTypes[0]];
-			for (uint32 j = 0; j < array.size(); j+=typeSize)
+		std::unique_lock<std::mutex> lock( graphMutex );
+		for (uint32 i = 0; i < updates[index].dependents.size(); i++)
+		{
+			uint32 dependent = updates[index].dependents[i];
+			if (--updates[dependent].numDependencies == 0)
 			{
-				BaseECSComponent *component = (BaseECSComponent *)&array[j];
-				systems[j]->updateComponents( delta, &component );
+				threadPool.addTask( [&runSystem, dependent]() { runSystem( dependent ); }, group );
 			}
 		}
-		else
+	};
+
+	// find all the systems which can start straight away before starting any,
+	// since the running ones will be counting down the others' dependencies
+	Array<uint32> readySystems;
+	for (uint32 i = 0; i < updates.size(); i++)
+	{
+		if (updates[i].numDependencies == 0)
 		{
-			updateSystemWithMultipleComponents( systems, i, delta, componentTypes, componentParam, componentBlockArray );
+			readySystems.push_back( i );
 		}
 	}
+	for (uint32 i = 0; i < readySystems.size(); i++)
+	{
+		uint32 index = readySystems[i];
+		threadPool.addTask( [&runSystem, index]() { runSystem( index ); }, group );
+	}
+	threadPool.waitForTasks( group );
 }
 
 //
-// Given the list of component types that the system requires, we first find the component type
-// from that list which has the smallest number of components in use (check the block).
-// Then we find all the entities which are using the components from the minimal list and check
-// if they have the other components that the system requires.  if so, then we update the system
-// and provide it the list of components from that entity.
-//
-// index - index of the system to update
-// delta - time delta for update
-// componentTypes - the componentTypes the system wants
-// componentParam - array used to hold ptrs to the components on the system
-// componnentArrays - array of components grouped in blocks by type
+// Two systems conflict if they both touch a component type in a (non-empty) archetype they share,
+// and at least one of them writes to it.  Reading the previous frame of a double buffered type
+// doesn't touch what's being written
 //
-void ECS::updateSystemWithMultipleComponents( ECSSystemList &systems, uint32 index, float delta, const Array<uint32> &componentTypes,
-	Array <BaseECSComponent*> &componentParam, Array <ComponentBlock*> &componentBlockArray )
+bool ECS::doSystemsConflict( const SystemUpdate &first, const SystemUpdate &second )
 {
-	const Array<uint32> &componentFlags = systems[index]->getComponentFlags();
-	componentParam.resize( Math::max( componentParam.size(), componentTypes.size() ) );
-	componentBlockArray.resize( Math::max( componentBlockArray.size(), componentTypes.size() ) );
+	const ECSQuery &firstQuery = *first.query;
+	const ECSQuery &secondQuery = *second.query;
+	const Array<uint32> &firstTypes = firstQuery.getComponentTypes();
+	const Array<uint32> &firstFlags = firstQuery.getComponentFlags();
+	const Array<uint32> &secondTypes = secondQuery.getComponentTypes();
+	const Array<uint32> &secondFlags = secondQuery.getComponentFlags();
 
-	// init the componentArrays array to point to the correct list of component groups
-	for (uint32 i = 0; i < componentTypes.size(); i++)
-	{
-		componentBlockArray[i] = &components[componentTypes[i]];
+	if (!firstQuery.getAccessMask().intersects( secondQuery.getAccessMask() ))
+	{	// no component types in common
+		return false;
 	}
 
-	// find the index of the least common component type
-	uint32 minSizeIndex = findLeastCommonComponent( componentTypes, componentFlags );
+	for (uint32 i = 0; i < firstQuery.getNumArchetypes(); i++)
+	{
+		if (firstQuery.getArchetype( i ).getNumEntities() == 0)
+		{
+			continue;
+		}
+		for (uint32 j = 0; j < secondQuery.getNumArchetypes(); j++)
+		{
+			if (&firstQuery.getArchetype( i ) != &secondQuery.getArchetype( j ))
+			{
+				continue;
+			}
 
-	// start with the smallest component type
-	size_t typeSize = BaseECSComponent::getTypeSize( componentTypes[minSizeIndex] );
+			const int32 *firstColumns = firstQuery.getColumns( i );
+			const int32 *secondColumns = secondQuery.getColumns( j );
+			for (uint32 k = 0; k < firstTypes.size(); k++)
+			{
+				if (firstColumns[k] < 0)
+				{	// optional and not in this archetype
+					continue;
+				}
+				bool isDoubleBuffered = firstQuery.getArchetype( i ).isDoubleBuffered( firstColumns[k] );
+				for (uint32 l = 0; l < secondTypes.size(); l++)
+				{
+					// fine as long as they both only read it
+					if (firstTypes[k] != secondTypes[l] || secondColumns[l] < 0 ||
+						(firstFlags[k] & secondFlags[l] & BaseECSSystem::FLAG_READ_ONLY) != 0)
+					{
+						continue;
+					}
+					if (!isDoubleBuffered || ((firstFlags[k] | secondFlags[l]) & BaseECSSystem::FLAG_PREVIOUS_FRAME) == 0)
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
 
-	ComponentBlock &compBlock = *componentBlockArray[minSizeIndex];
+	return false;
+}
 
-	// get the group of components for that type
-	// TODO - make it easier to iterate over all components of a certain type
-	for (uint32 i = 0; i < compBlock.size(); i += typeSize)
+//
+// Work through the archetypes one row at a time: put the entity which belongs in the row there
+// by swapping it with whatever is there now.  Anything could have changed between calls, so when
+// the archetype's entities don't match the order we worked out for it, the rows which are left
+// are sorted again and the pass carries on from the same row.  The rows before it stay as they are
+// (at worst a little out of order until the next pass), so the archetype still gets finished while
+// entities come and go.
+//
+bool ECS::defragment( double timeBudget )
+{
+	double endTime = Time::getTime() + timeBudget;
+	for (uint32 numSteps = 1; defragArchetype < archetypes.size(); numSteps++)
 	{
-		// get the next component of that type
-		componentParam[minSizeIndex] = (BaseECSComponent*)&compBlock[i];
+		if (numSteps % ECS_DEFRAGMENT_STEPS_PER_TIME_CHECK == 0 && Time::getTime() >= endTime)
+		{
+			return false;
+		}
 
-		// get the entity attached to that component, and go thru it's components
-		EntityType &entityComponents = handleToEntity( componentParam[minSizeIndex]->entity );
+		ECSArchetype &archetype = *archetypes[defragArchetype];
+		if (defragRow >= archetype.getNumEntities())
+		{
+			defragArchetype++;
+			defragRow = 0;
+			defragOrder.clear();
+			continue;
+		}
 
-		// if the entity has all the remaining components that we need, then we update it's components
-		bool isValid = true;
-		for (uint32 j = 0; j < componentTypes.size(); j++)
+		EntityRecord *entity = defragOrder.size() == archetype.getNumEntities() ? handleToRecord( defragOrder[defragRow] ) : nullptr;
+		if (entity == nullptr || entity->archetype != &archetype || entity->row < defragRow)
 		{
-			if (j == minSizeIndex)
-			{	// we know this entity already has this component type (since that's how we looked it up),
-				// so no need to check that
-				continue;
+			// The sort is part of the budget: the clock is next looked at a full run of rows later,
+			// which counts the sort and makes sure each call moves on a little however long it took
+			defragOrder.resize( archetype.getNumEntities() );
+			for (uint32 i = defragRow; i < defragOrder.size(); i++)
+			{
+				defragOrder[i] = archetype.getEntity( i );
 			}
+			std::sort( defragOrder.begin() + defragRow, defragOrder.end(), []( EntityHandle a, EntityHandle b )
+			{
+				return handleToIndex( a ) < handleToIndex( b );
+			} );
+			numSteps = 0;
+			continue;
+		}
+		if (entity->row != defragRow)
+		{
+			EntityHandle displaced = archetype.getEntity( defragRow );
+			archetype.swapRows( entity->row, defragRow );
+			entities[handleToIndex( displaced )].row = entity->row;
+			entity->row = defragRow;
+		}
+		defragRow++;
+	}
+
+	chunkAllocator.releaseFreeBlocks();
+	defragArchetype = 0;
+	return true;
+}
+
+//
+// Stamp the system's run with a new version, and return the version of its last run
+// (0 if it hasn't run on this ECS before)
+//
+uint32 ECS::swapSystemVersion( BaseECSSystem &system, uint32 version )
+{
+	Map<BaseECSSystem*, uint32>::iterator it = systemVersions.find( &system );
+	if (it == systemVersions.end())
+	{
+		systemVersions[&system] = version;
+		return 0;
+	}
+	uint32 lastVersion = it->second;
+	it->second = version;
+	return lastVersion;
+}
 
-			componentParam[j] = getComponentInternal( entityComponents, *componentBlockArray[j], componentTypes[j] );
-			if (componentParam[j] == nullptr && (componentFlags[j] & BaseECSSystem::FLAG_OPTIONAL) == 0)
+//
+// Run a system over every archetype its query matched on this thread, skipping the chunks its change
+// filter says haven't changed, and stamp the components it wrote
+//
+void ECS::runSystemChunks( const SystemUpdate &update, float delta, bool isWriting )
+{
+	BaseECSSystem &system = *update.system;
+	const ECSQuery &systemQuery = *update.query;
+	ECSComponentBatch batch;
+#ifdef ECS_PROFILING
+	ECSProfileCounts counts;
+	double startTime = profiler.beginSample();
+#endif
+	for (uint32 i = 0; i < systemQuery.getNumArchetypes(); i++)
+	{
+		ECSArchetype &archetype = systemQuery.getArchetype( i );
+#ifdef ECS_PROFILING
+		size_t rowSize = ECSProfiler::getRowSize( systemQuery, i );
+#endif
+		for (uint32 j = 0; j < archetype.getNumChunks(); j++)
+		{
+			ECSChunk &chunk = archetype.getChunk( j );
+			if (systemQuery.hasChangeFilter() && !systemQuery.hasChanged( i, chunk, update.lastVersion ))
 			{
-				isValid = false;
-				break;
+				continue;
 			}
+			systemQuery.getBatch( i, chunk, batch );
+			system.updateBatch( delta, batch );
+			if (isWriting)
+			{
+				systemQuery.markWritten( i, chunk, update.version );
+			}
+#ifdef ECS_PROFILING
+			counts.addChunk( chunk, rowSize );
+#endif
 		}
+	}
+#ifdef ECS_PROFILING
+	profiler.endSample( system, systemQuery, startTime, counts );
+#endif
+}
 
-		if (isValid)
-		{	// confirmed that the entity has the components that the system operates on, so update
-			systems[index]->updateComponents( delta, &componentParam[0] );
+//
+// Systems which aren't thread safe run on the thread which picked them up.
+// Thread safe systems are split up further: each chunk becomes its own task,
+// and we wait for them all before the system counts as finished.
+//
+void ECS::runSystemUpdate( SystemUpdate &update, float delta, ThreadPool &threadPool )
+{
+	if (!update.system->isThreadSafe())
+	{
+		runSystemChunks( update, delta );
+		return;
+	}
+
+	BaseECSSystem &system = *update.system;
+	const ECSQuery &systemQuery = *update.query;
+#ifdef ECS_PROFILING
+	ECSProfileCounts counts;
+	double startTime = profiler.beginSample();
+#endif
+
+	// chunks don't share any memory, so each one can go to a different thread as long as it has its own batch
+	ThreadPool::TaskGroup group;
+	for (uint32 i = 0; i < systemQuery.getNumArchetypes(); i++)
+	{
+		ECSArchetype &archetype = systemQuery.getArchetype( i );
+#ifdef ECS_PROFILING
+		size_t rowSize = ECSProfiler::getRowSize( systemQuery, i );
+#endif
+		for (uint32 j = 0; j < archetype.getNumChunks(); j++)
+		{
+			ECSChunk *chunk = &archetype.getChunk( j );
+			if (systemQuery.hasChangeFilter() && !systemQuery.hasChanged( i, *chunk, update.lastVersion ))
+			{
+				continue;
+			}
+			uint32 version = update.version;
+#ifdef ECS_PROFILING
+			// counted when the task runs, the chunk's entities can't change before then
+			threadPool.addTask( [&system, &systemQuery, i, chunk, delta, version, &counts, rowSize]()
+#else
+			threadPool.addTask( [&system, &systemQuery, i, chunk, delta, version]()
+#endif
+			{
+				ECSComponentBatch batch;
+				systemQuery.getBatch( i, *chunk, batch );
+				system.updateBatch( delta, batch );
+				systemQuery.markWritten( i, *chunk, version );
+#ifdef ECS_PROFILING
+				counts.addChunk( *chunk, rowSize );
+#endif
+			}, group );
 		}
 	}
+	threadPool.waitForTasks( group );
+#ifdef ECS_PROFILING
+	profiler.endSample( system, systemQuery, startTime, counts );
+#endif
 }
 
 //
-// checks the number of components of each type and returns the index 
-// of the smallest non-optional type 
+// Each singleton gets its own allocation, which it keeps until it's removed
 //
-uint32 ECS::findLeastCommonComponent( const Array<uint32> &componentTypes, const Array<uint32> &componentFlags )
+bool ECS::setSingletonByType( uint32 componentID, const BaseECSComponent *component )
 {
-	// gets number of components in the first group
-	uint32 minSize = (uint32)-1;	// TODO use MAX_INT here?
-	uint32 minIndx = (uint32)-1;
-	for (uint32 i = 0; i < componentTypes.size(); i++)
+	if (!BaseECSComponent::isTypeValid( componentID ))
 	{
-		if ( (componentFlags[i] & BaseECSSystem::FLAG_OPTIONAL) != 0)
-		{	// skip the optional component types
-			continue;
-		}
-		uint32 size = components[componentTypes[i]].size() / BaseECSComponent::getTypeSize( componentTypes[i] );
-		if (size <= minSize)
+		DEBUG_LOG( "ECS", LOG_ERROR, "%u is not a valid component type", componentID );
+		return false;
+	}
+	if (componentID >= singletons.size())
+	{
+		singletons.resize( componentID + 1, nullptr );
+	}
+
+	BaseECSComponent *&singleton = singletons[componentID];
+	if (singleton == component)
+	{	// setting it to itself
+		return true;
+	}
+	if (singleton == nullptr)
+	{
+		singleton = (BaseECSComponent*)Memory::malloc( BaseECSComponent::getTypeSize( componentID ),
+			(uint32)Math::max( BaseECSComponent::getTypeAlignment( componentID ), (size_t)Memory::DEFAULT_ALIGNMENT ) );
+	}
+	else
+	{
+		BaseECSComponent::getTypeFreeFunction( componentID )( singleton );
+	}
+	BaseECSComponent::getTypeCreateFunction( componentID )( singleton, NULL_ENTITY_HANDLE, (BaseECSComponent*)component );
+	return true;
+}
+
+bool ECS::removeSingletonByType( uint32 componentID )
+{
+	BaseECSComponent *singleton = getSingletonByType( componentID );
+	if (singleton == nullptr)
+	{
+		return false;
+	}
+	BaseECSComponent::getTypeFreeFunction( componentID )( singleton );
+	Memory::free( singleton );
+	singletons[componentID] = nullptr;
+	return true;
+}
+
+bool ECS::setDoubleBufferedByType( uint32 componentID )
+{
+	if (!BaseECSComponent::isTypeValid( componentID ))
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "%u is not a valid component type", componentID );
+		return false;
+	}
+	if ((BaseECSComponent::getTypeFlags( componentID ) & ECS_COMPONENT_TRIVIALLY_COPYABLE) == 0 ||
+		BaseECSComponent::getTypeFields( componentID ) != nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "component type %u can't be double buffered, it has to be trivially copyable without a SoA layout",
+			componentID );
+		return false;
+	}
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{	// the archetype's chunks don't have room for the copy
+		if (archetypes[i]->hasComponent( componentID ))
 		{
-			minSize = size;
-			minIndx = i;
+			DEBUG_LOG( "ECS", LOG_ERROR, "component type %u is already in use, double buffer it before making entities with it",
+				componentID );
+			return false;
 		}
 	}
 
-	return minIndx;
+	doubleBuffered.set( componentID );
+	return true;
+}
+
+//
+// Only the chunks where a double buffered column was written since the last swap are copied
+//
+void ECS::swapBuffers()
+{
+	uint32 sinceVersion = lastSwapVersion;
+	lastSwapVersion = advanceChangeVersion();
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{
+		archetypes[i]->copyToPrevious( sinceVersion );
+	}
 }
@@ -2,15 +2,42 @@
 
 #include "ecsComponent.hpp"
 #include "ecsSystem.hpp"
+#include "ecsArchetype.hpp"
+#include "ecsQuery.hpp"
+#include "ecsCommandBuffer.hpp"
+#include "ecsProfiler.hpp"
+#include "ecsPrefab.hpp"
 #include "dataStructures/map.hpp"
+#include "dataStructures/string.hpp"
 #include "dataStructures/array.hpp"
 #include "core/common.hpp"
+#include "core/threadPool.hpp"
+#include <type_traits>
+#include <algorithm>
+#include <functional>
+#include <utility>
 
 class ECSListener
 {
 public:
 	virtual void onMakeEntity(EntityHandle handle) {}
+	// called once for entities made together, instead of onMakeEntity for each of them
+	virtual void onMakeEntities(const EntityHandle *handles, size_t numHandles)
+	{
+		for (size_t i = 0; i < numHandles; i++)
+		{
+			onMakeEntity(handles[i]);
+		}
+	}
 	virtual void onRemoveEntity(EntityHandle handle) {}
+	// called once for entities removed together, instead of onRemoveEntity for each of them
+	virtual void onRemoveEntities(const EntityHandle *handles, size_t numHandles)
+	{
+		for (size_t i = 0; i < numHandles; i++)
+		{
+			onRemoveEntity(handles[i]);
+		}
+	}
 	virtual void onAddComponent(EntityHandle handle, uint32 id) {}
 	virtual void onRemoveComponent(EntityHandle handle, uint32 id) {}
 
@@ -28,123 +55,404 @@ public:
 	~ECS();
 
 	// ECSListener methods
-	void addListener(ECSListener *listener)
-	{
-		listeners.push_back(listener);
-	}
+	// the listener's component IDs have to be set up before it is added
+	void addListener( ECSListener *listener );
 
 	// Entity methods
 	EntityHandle makeEntity( BaseECSComponent **components, const uint32 *componentIDs, size_t numComponents );
 	void removeEntity( EntityHandle handle );
 
-	template<class... Components>
-	EntityHandle makeEntity( Components&&... entitycomponents )
+	// only takes part in overload resolution for components, so it doesn't hide the raw version above
+	template<class Component, class... Components, typename std::enable_if<
+		std::is_base_of<BaseECSComponent, std::remove_reference_t<Component>>::value, int>::type = 0>
+	EntityHandle makeEntity( Component&& entitycomponent, Components&&... entitycomponents )
 	{
-		BaseECSComponent * comps[] = { (&entitycomponents)... };
-		uint32 componentIDs[] = { (std::remove_reference_t<Components>::ID)... };
-		return makeEntity( comps, componentIDs, sizeof...(Components) );
+		BaseECSComponent * comps[] = { &entitycomponent, (&entitycomponents)... };
+		const uint32 componentIDs[] = { std::remove_reference_t<Component>::ID,
+			(std::remove_reference_t<Components>::ID)... };
+		return makeEntity( &comps[0], &componentIDs[0], 1 + sizeof...(Components) );
 	}
 
+	// Makes count entities, each with copies of the prototype components.  The handles of the new entities
+	// are written to handlesOut if it isn't null, and initializer (if set) is called on each new entity
+	// with its components (in the order of componentIDs) to set them up.
+	// Returns the number of entities made
+	typedef std::function<void( uint32 index, EntityHandle handle, BaseECSComponent **components )> EntityInitializer;
+	uint32 makeEntities( uint32 count, BaseECSComponent **prototypes, const uint32 *componentIDs, size_t numComponents,
+		EntityHandle *handlesOut = nullptr, const EntityInitializer &initializer = nullptr );
+
+	template<class Component, class... Components, typename std::enable_if<
+		std::is_base_of<BaseECSComponent, Component>::value, int>::type = 0>
+	uint32 makeEntities( uint32 count, EntityHandle *handlesOut, const Component &prototype, const Components&... prototypes )
+	{
+		BaseECSComponent *comps[] = { (BaseECSComponent*)&prototype, (BaseECSComponent*)&prototypes... };
+		const uint32 componentIDs[] = { Component::ID, Components::ID... };
+		return makeEntities( count, &comps[0], &componentIDs[0], 1 + sizeof...(Components), handlesOut );
+	}
+
+	// initializer is called as initializer( uint32 index, Components&... components )
+	template<class Initializer, class... Components, typename std::enable_if<
+		!std::is_base_of<BaseECSComponent, Initializer>::value, int>::type = 0>
+	uint32 makeEntities( uint32 count, EntityHandle *handlesOut, Initializer initializer, const Components&... prototypes )
+	{
+		BaseECSComponent *comps[] = { (BaseECSComponent*)&prototypes... };
+		const uint32 componentIDs[] = { Components::ID... };
+		return makeEntities( count, &comps[0], &componentIDs[0], sizeof...(Components), handlesOut,
+			[&initializer]( uint32 index, EntityHandle, BaseECSComponent **components )
+		{
+			callInitializer<Initializer, Components...>( initializer, index, components,
+				std::index_sequence_for<Components...>() );
+		} );
+	}
+
+	// Makes count entities from the prefab, with each of its components copied into all of them in bulk.
+	// initializer (if set) is called on each new entity with the components listed in initializerIDs
+	// (in that order), so it only has to be given the ones it changes.
+	// Returns the number of entities made
+	uint32 instantiate( const ECSPrefab &prefab, uint32 count, EntityHandle *handlesOut = nullptr,
+		const uint32 *initializerIDs = nullptr, size_t numInitializerIDs = 0, const EntityInitializer &initializer = nullptr );
+
+	// initializer is called as initializer( uint32 index, Component &component, Components&... components )
+	template<class Component, class... Components, class Initializer, typename std::enable_if<
+		std::is_class<Initializer>::value, int>::type = 0>
+	uint32 instantiate( const ECSPrefab &prefab, uint32 count, EntityHandle *handlesOut, Initializer initializer )
+	{
+		const uint32 componentIDs[] = { Component::ID, Components::ID... };
+		return instantiate( prefab, count, handlesOut, &componentIDs[0], 1 + sizeof...(Components),
+			[&initializer]( uint32 index, EntityHandle, BaseECSComponent **components )
+		{
+			callInitializer<Initializer, Component, Components...>( initializer, index, components,
+				std::index_sequence_for<Component, Components...>() );
+		} );
+	}
+
+	// removes all the entities at once, which is cheaper than removing them one at a time.
+	// Stale and repeated handles are skipped
+	void removeEntities( const EntityHandle *handles, size_t numHandles );
+
 	// Component methods
 	template <class Component>
 	void addComponent( EntityHandle entityHandle, Component *component )
 	{
-		addComponentInternal( entityHandle, handleToEntity( entityHandle ), Component::ID, component );
-
-		// notify any listeners who care about this type of component
-		for (uint32 i = 0; i < listeners.size(); i++)
-		{
-			const Array<uint32> &componentIDs = listeners[i]->getComponentIDs();
-			for (uint32 j = 0; j < componentIDs.size(); j++)
-			{
-				if (componentIDs[j] == Component::ID)
-				{
-					listeners[i]->onAddComponent(entity, Component::ID);
-					break;
-				}
-			}
-		}
+		addComponentByType( entityHandle, Component::ID, component );
 	}
-	
+
 	template <class Component>
 	bool removeComponent( EntityHandle entityHandle )
 	{
-		// notify any listeners who care about this type of component
-		for (uint32 i = 0; i < listeners.size(); i++)
-		{
-			const Array<uint32> &componentIDs = listeners[i]->getComponentIDs();
-			for (uint32 j = 0; j < componentIDs.size(); j++)
-			{
-				if (componentIDs[j] == Component::ID)
-				{
-					listeners[i]->onRemoveComponent(entity, Component::ID);
-					break;
-				}
-			}
-		}
-		return removeComponentInternal( entityHandle, Component::ID );
+		return removeComponentByType( entityHandle, Component::ID );
 	}
-	
+
+	// return true on success
+	bool addComponentByType( EntityHandle entityHandle, uint32 componentID, BaseECSComponent *component );
+	bool removeComponentByType( EntityHandle entityHandle, uint32 componentID );
+
+	// SoA components aren't stored whole, copy them in and out with readComponent/writeComponent instead
 	template <class Component>
 	Component *getComponent( EntityHandle entityHandle )
 	{
-		return static_cast<Component*>(getComponentInternal( handleToEntity( entityHandle ), components[Component::ID], Component::ID));
+		static_assert(!ECSComponentTraits<Component>::IS_TAG, "tags have no data, use hasComponent");
+		static_assert(!ECSComponentLayout<Component>::IS_SOA, "SoA components are copied with readComponent");
+		EntityRecord *entity = handleToRecord( entityHandle );
+		int32 column = entity != nullptr ? entity->archetype->getColumnIndex( Component::ID ) : -1;
+		return column >= 0 ? entity->archetype->getComponent<Component>( entity->row, column ) : nullptr;
+	}
+
+	// copy a component of any layout out of (or into) the entity.  Only for trivially copyable components.
+	// Return false if the entity doesn't have the component
+	template <class Component>
+	bool readComponent( EntityHandle entityHandle, Component &component )
+	{
+		static_assert(std::is_trivially_copyable<Component>::value, "use getComponent");
+		return readComponentByType( entityHandle, Component::ID, &component );
 	}
 
+	template <class Component>
+	bool writeComponent( EntityHandle entityHandle, const Component &component )
+	{
+		static_assert(std::is_trivially_copyable<Component>::value, "use getComponent");
+		return writeComponentByType( entityHandle, Component::ID, &component );
+	}
+
+	bool readComponentByType( EntityHandle entityHandle, uint32 componentID, BaseECSComponent *component );
+	bool writeComponentByType( EntityHandle entityHandle, uint32 componentID, const BaseECSComponent *component );
+
+	// Singleton methods
+	// a singleton is a component kept once by the ECS instead of by an entity, for global state like the
+	// camera or the input.  There's at most one of each type, found straight from its ID without going
+	// through any entities.  Setting one which is already there copies over it, so pointers to it stay good
+	// until it's removed.  Singletons have no entity and aren't saved in snapshots
+	template <class Component>
+	void setSingleton( const Component &component )
+	{
+		setSingletonByType( Component::ID, &component );
+	}
+
+	// null if the singleton hasn't been set
+	template <class Component>
+	Component *getSingleton()
+	{
+		return static_cast<Component*>(getSingletonByType( Component::ID ));
+	}
+
+	template <class Component>
+	bool removeSingleton()
+	{
+		return removeSingletonByType( Component::ID );
+	}
+
+	// return true on success
+	bool setSingletonByType( uint32 componentID, const BaseECSComponent *component );
+	bool removeSingletonByType( uint32 componentID );
+	BaseECSComponent *getSingletonByType( uint32 componentID )
+	{
+		return componentID < singletons.size() ? singletons[componentID] : nullptr;
+	}
+
+	// Double buffering
+	// a double buffered component type keeps a second copy of its components, made by swapBuffers, which
+	// systems read with FLAG_PREVIOUS_FRAME.  Rendering can then read one frame while the next one is
+	// being simulated (see ECSFramePipeline).  Only trivially copyable types without a SoA layout can be
+	// double buffered, and it has to be set up before any entity has the type.  Returns true on success
+	template <class Component>
+	bool setDoubleBuffered()
+	{
+		return setDoubleBufferedByType( Component::ID );
+	}
+	bool setDoubleBufferedByType( uint32 componentID );
+	bool isDoubleBuffered( uint32 componentID ) const { return doubleBuffered.test( componentID ); }
+
+	// copies the double buffered components written since the last swap into their previous frame copies.
+	// Call it when nothing is reading them
+	void swapBuffers();
+
+	// Snapshot methods (see ecsSnapshot.hpp)
+	// saves every entity and component to the file.  Fails if a component type which isn't trivially
+	// copyable has no serialize hooks
+	bool saveSnapshot( const String &fileName );
+	// loads a snapshot into an ECS which doesn't have any entities, keeping the handles the entities had
+	bool loadSnapshot( const String &fileName );
+
+	// Sorts the rows of each archetype into entity index order, a little at a time, then gives
+	// completely free chunk memory back to the system.  Removing entities swaps the last row into
+	// the gap, so over time rows end up in a random order; sorting them keeps entities made
+	// together (and looked up together) next to each other in memory.
+	// Stops after about timeBudget seconds and carries on where it left off next time.
+	// Returns true when a whole pass is done
+	bool defragment( double timeBudget );
+	const ECSChunkAllocator &getChunkAllocator() const { return chunkAllocator; }
+
+	// Change detection
+	// every write the ECS knows about (systems writing components they don't just read, writeComponent,
+	// making entities and adding components) stamps the chunk's column with the current change version.
+	// Writes through a getComponent pointer aren't seen unless they're followed by markChanged
+	template <class Component>
+	bool markChanged( EntityHandle entityHandle )
+	{
+		return markChangedByType( entityHandle, Component::ID );
+	}
+	bool markChangedByType( EntityHandle entityHandle, uint32 componentID );
+
+	// the change version of the column holding the entity's component (0 if it doesn't have one).
+	// Versions are kept per chunk, so this is when any component of the type in the chunk last changed
+	template <class Component>
+	uint32 getChangeVersion( EntityHandle entityHandle )
+	{
+		return getChangeVersionByType( entityHandle, Component::ID );
+	}
+	uint32 getChangeVersionByType( EntityHandle entityHandle, uint32 componentID );
+
+	// returns the current change version and moves on to the next one, so everything written after
+	// the call has a greater version.  Pass it to ECSQuery::forEachChangedBatch later on
+	uint32 advanceChangeVersion() { return changeVersion++; }
+	// the version markChanged and writes outside of systems stamp on the columns
+	uint32 getCurrentChangeVersion() const { return changeVersion; }
+
 	BaseECSComponent *getComponentByType(EntityHandle entityHandle, uint32 componentID)
 	{
-		return getComponentInternal(handleToEntity(entityHandle), components[componentID], componentID);
+		return getComponentInternal( entityHandle, componentID );
 	}
 
-	// System methods
+	template <class Component>
+	bool hasComponent( EntityHandle entityHandle )
+	{
+		return hasComponentByType( entityHandle, Component::ID );
+	}
+
+	bool hasComponentByType( EntityHandle entityHandle, uint32 componentID )
+	{
+		EntityRecord *entity = handleToRecord( entityHandle );
+		return entity != nullptr && entity->archetype->hasComponent( componentID );
+	}
+
+	// the entity's component types, empty if the handle is stale
+	ECSComponentMask getComponentMask( EntityHandle entityHandle )
+	{
+		EntityRecord *entity = handleToRecord( entityHandle );
+		return entity != nullptr ? entity->archetype->getMask() : ECSComponentMask();
+	}
 
+	bool isValid( EntityHandle entityHandle )
+	{
+		return handleToRecord( entityHandle ) != nullptr;
+	}
 
+	uint32 getNumEntities() const { return numEntities; }
+
+	// Query methods
+	// queries are cached and kept up to date by the ECS, so keep hold of them (or ask again each frame)
+	// rather than searching the entities yourself
+	template <class... Components>
+	ECSQuery &query()
+	{
+		const uint32 componentIDs[] = { Components::ID... };
+		Array<uint32> componentTypes( sizeof...(Components) );
+		std::copy( componentIDs, componentIDs + sizeof...(Components), componentTypes.begin() );
+		return query( componentTypes, Array<uint32>( sizeof...(Components) ) );
+	}
+
+	ECSQuery &query( const Array<uint32> &componentTypes, const Array<uint32> &componentFlags );
+
+	// System methods
+
+	// Systems with FLAG_CHANGED component types skip the chunks where none of those types
+	// changed since the system last ran on this ECS.
 	void updateSystems( ECSSystemList &systems, float delta );
 
+	// Updates the systems on the thread pool.  A system waits for the systems before it in the list
+	// which touch the same components in the same archetypes (unless they both only read them),
+	// and everything else runs at the same time.
+	// Systems which touch shared state other than their components should be updated serially.
+	void updateSystems( ECSSystemList &systems, float delta, ThreadPool &threadPool );
+
+#ifdef ECS_PROFILING
+	// records every system update
+	ECSProfiler &getProfiler() { return profiler; }
+#endif
+
 private:
 
-	// map of components.  Holds multiple component lists, organized by component ID
-	Map<uint32 /* compID */, ComponentBlock> components;
+	// Every distinct set of component types gets its own archetype, which stores the components
+	// of all the entities with that set.  Archetypes are looked up by their sorted component IDs.
+	Map<Array<uint32> /* sorted compIDs */, ECSArchetype*> archetypeMap;
+	ECSChunkAllocator chunkAllocator;	// shared by all the archetypes, which give their chunks back in ~ECS
+	Array<ECSArchetype*> archetypes;
+	Array<uint32> scratchIDs;	// reused when building archetype keys, so entity changes don't allocate
+
+	// queries are looked up by their component types followed by their flags
+	Map<Array<uint32> /* types + flags */, ECSQuery*> queryMap;
+	Array<ECSQuery*> queries;
+	Array<uint32> scratchQueryKey;
 
-	// an entity is an array of components, each described by componentID and componentIndex
-	// the componentIndex looks up the component in the appropriate memory block from the map above
-	// cache friendly!
-	typedef Array<std::pair<uint32, uint32>> EntityType;
+	// where the defragment pass is up to, and the order it's putting the current archetype in
+	uint32 defragArchetype = 0;
+	uint32 defragRow = 0;
+	Array<EntityHandle> defragOrder;
 
-	// the list of entities, each paired with it's index in the list (for easy removal)
-	Array <	std::pair<uint32, EntityType>* > entities;
+	Array<BaseECSComponent*> singletons;	// by component ID, null where there isn't one
+
+	ECSComponentMask doubleBuffered;	// the double buffered component types
+	uint32 lastSwapVersion = 0;			// the change version of the last swapBuffers
+
+	uint32 changeVersion = 1;		// stamped on the columns written to
+	Map<BaseECSSystem*, uint32> systemVersions;		// the version each system last ran with
+
+#ifdef ECS_PROFILING
+	ECSProfiler profiler;
+#endif
+
+	// an entity is described by the archetype holding its components and its row within that archetype
+	struct EntityRecord
+	{
+		ECSArchetype *archetype;	// null while the slot is free
+		uint32 row;					// row in the archetype, or the next free slot while the slot is free
+		uint32 generation;			// bumped whenever the slot is freed
+	};
+
+	// slot map of entities, the handle holds the slot index and generation.
+	// Freed slots are chained together into a free list and reused.
+	Array<EntityRecord> entities;
+	uint32 freeEntityList = NULL_ENTITY_HANDLE;
+	uint32 numEntities = 0;
 	Array<ECSListener *> listeners;
+	Array<ECSComponentMask> listenerMasks;		// the component types of each listener
+	Array<Array<uint32>> componentListeners;	// listeners with each component type (by component ID)
+	Array<Array<uint32>> archetypeListeners;	// listeners with a subset of each archetype's types (by archetype index)
+
+	static EntityHandle makeHandle( uint32 index, uint32 generation )
+	{
+		return (generation << ECS_ENTITY_INDEX_BITS) | index;
+	}
 
-	
-	std::pair<uint32, EntityType> *handleToRawType( EntityHandle handle )
+	static uint32 handleToIndex( EntityHandle handle )
 	{
-		return static_cast<std::pair<uint32, EntityType>*>(handle);
+		return handle & ECS_ENTITY_INDEX_MASK;
 	}
 
-	// returns the entity's index in the list, from a handle
-	uint32 handleToEntityIndex( EntityHandle handle )
+	// returns the entity record, or null if the handle is stale
+	EntityRecord *handleToRecord( EntityHandle handle )
 	{
-		return handleToRawType( handle )->first;
+		uint32 index = handleToIndex( handle );
+		if (index >= entities.size() || entities[index].archetype == nullptr ||
+			entities[index].generation != (handle >> ECS_ENTITY_INDEX_BITS))
+		{
+			return nullptr;
+		}
+		return &entities[index];
 	}
 
-	// return the entity as list of components, from a handle
-	EntityType& handleToEntity( EntityHandle handle )
+	template<class Initializer, class... Components, size_t... Indices>
+	static void callInitializer( Initializer &initializer, uint32 index, BaseECSComponent **components,
+		std::index_sequence<Indices...> )
 	{
-		std::pair<uint32, EntityType> *ent = handleToRawType(handle);
-		return ent->second;
+		initializer( index, *static_cast<Components*>(components[Indices])... );
 	}
 
-	void deleteComponent( uint32 componentID, uint32 index );
+	EntityHandle allocateEntity();
+	void freeEntity( EntityHandle handle );
+	void notifyRemoveEntities( const EntityHandle *handles, size_t numHandles, ECSArchetype *archetype );
+	void notifyComponentChange( EntityHandle handle, uint32 componentID, bool isAdded );
+	ECSArchetype *findOrCreateArchetype( const Array<uint32> &componentIDs );
+	void moveEntity( EntityHandle handle, ECSArchetype *dest );
 	bool removeComponentInternal( EntityHandle handle, uint32 componentID );
-	void addComponentInternal( EntityHandle handle, EntityType &entity, uint32 componentID, BaseECSComponent *component );
+	bool addComponentInternal( EntityHandle handle, uint32 componentID, BaseECSComponent *component );
+
+	// look up the column in the entity's archetype and return a pointer to the component with the matching componentID
+	// (null for SoA components, which aren't stored whole).
+	// Constant time: slot map -> archetype -> per component ID column table
+	BaseECSComponent *getComponentInternal( EntityHandle handle, uint32 componentID )
+	{
+		EntityRecord *entity = handleToRecord( handle );
+		if (entity == nullptr)
+		{
+			return nullptr;
+		}
+		int32 column = entity->archetype->getColumnIndex( componentID );
+		if (column < 0 || entity->archetype->isSoAColumn( column ))
+		{
+			return nullptr;
+		}
 
-	// go thru all the components on an entity and return a pointer to the one with the matching componentID
-	BaseECSComponent *getComponentInternal( EntityType &entityComponents, ComponentBlock &compBlock, uint32 componentID );
+		return entity->archetype->getComponent( entity->row, column );
+	}
 
-	void updateSystemWithMultipleComponents( ECSSystemList &systems, uint32 index, float delta, 
-		const Array<uint32> &componentTypes, Array <BaseECSComponent*> &componentParam, 
-		Array <ComponentBlock*> &componentBlockArray);
-	uint32 findLeastCommonComponent( const Array<uint32> &componentTypes, const Array<uint32> &componentFlags );
+	// a system with the query it runs on, and which systems wait for it when they are scheduled in parallel
+	struct SystemUpdate
+	{
+		BaseECSSystem *system;
+		ECSQuery *query;
+		uint32 version;					// stamped on the components the system writes
+		uint32 lastVersion;				// the version the system last ran with, for its change filter
+		Array<uint32> dependents;		// systems which have to wait for this one to finish
+		uint32 numDependencies;			// number of systems this one is still waiting for
+	};
+
+	static bool doSystemsConflict( const SystemUpdate &first, const SystemUpdate &second );
+	uint32 swapSystemVersion( BaseECSSystem &system, uint32 version );
+	// isWriting false leaves the change versions alone, for systems running alongside others which write them
+	void runSystemChunks( const SystemUpdate &update, float delta, bool isWriting = true );
+	void runSystemUpdate( SystemUpdate &update, float delta, ThreadPool &threadPool );
+	friend class ECSFramePipeline;	// runs the render systems through runSystemChunks
 
 	NULL_COPY_AND_ASSIGN( ECS );
-};
\ No newline at end of file
+};
@@ -0,0 +1,578 @@
+#include <algorithm>
+#include "core/memory.hpp"
+#include "math/math.hpp"
+#include "ecsArchetype.hpp"
+
+ECSChunkAllocator::~ECSChunkAllocator()
+{
+	for (uint32 i = 0; i < blocks.size(); i++)
+	{
+		Memory::free( blocks[i] );
+	}
+}
+
+uint8 *ECSChunkAllocator::allocate( size_t size )
+{
+	if (size > ECS_CHUNK_SIZE)
+	{
+		return (uint8*)Memory::malloc( size, ECS_CHUNK_ALIGNMENT );
+	}
+
+	if (freeList == nullptr)
+	{	// carve a new block up into chunks
+		uint8 *block = (uint8*)Memory::malloc( ECS_CHUNK_SIZE * ECS_CHUNKS_PER_BLOCK, ECS_CHUNK_ALIGNMENT );
+		blocks.push_back( block );
+		for (uint32 i = ECS_CHUNKS_PER_BLOCK; i > 0; i--)
+		{
+			uint8 *chunk = block + (i - 1) * ECS_CHUNK_SIZE;
+			*(uint8**)chunk = freeList;
+			freeList = chunk;
+		}
+		numFreeChunks += ECS_CHUNKS_PER_BLOCK;
+	}
+
+	uint8 *chunk = freeList;
+	freeList = *(uint8**)chunk;
+	numFreeChunks--;
+	return chunk;
+}
+
+void ECSChunkAllocator::free( uint8 *memory, size_t size )
+{
+	if (size > ECS_CHUNK_SIZE)
+	{
+		Memory::free( memory );
+		return;
+	}
+
+	*(uint8**)memory = freeList;
+	freeList = memory;
+	numFreeChunks++;
+}
+
+//
+// Blocks are kept sorted by address, so the block holding a chunk is the last one which starts before it
+//
+size_t ECSChunkAllocator::findBlock( uint8 *chunk ) const
+{
+	return (size_t)(std::upper_bound( blocks.begin(), blocks.end(), chunk ) - blocks.begin()) - 1;
+}
+
+//
+// Count the free chunks in each block, then take the chunks of the completely free blocks
+// out of the free list and free the blocks
+//
+size_t ECSChunkAllocator::releaseFreeBlocks()
+{
+	if (numFreeChunks < ECS_CHUNKS_PER_BLOCK)
+	{
+		return 0;
+	}
+
+	std::sort( blocks.begin(), blocks.end() );
+	Array<uint32> numFreeInBlock( blocks.size() );
+	for (uint8 *chunk = freeList; chunk != nullptr; chunk = *(uint8**)chunk)
+	{
+		numFreeInBlock[findBlock( chunk )]++;
+	}
+
+	uint8 **link = &freeList;
+	for (uint8 *chunk = freeList; chunk != nullptr; )
+	{
+		uint8 *nextChunk = *(uint8**)chunk;
+		if (numFreeInBlock[findBlock( chunk )] != ECS_CHUNKS_PER_BLOCK)
+		{
+			*link = chunk;
+			link = (uint8**)chunk;
+		}
+		chunk = nextChunk;
+	}
+	*link = nullptr;
+
+	size_t numReleased = 0;
+	for (uint32 i = 0; i < blocks.size(); i++)
+	{
+		if (numFreeInBlock[i] == ECS_CHUNKS_PER_BLOCK)
+		{
+			Memory::free( blocks[i] );
+			numReleased++;
+		}
+		else
+		{
+			blocks[i - numReleased] = blocks[i];
+		}
+	}
+	blocks.resize( blocks.size() - numReleased );
+	numFreeChunks -= numReleased * ECS_CHUNKS_PER_BLOCK;
+	return numReleased;
+}
+
+//
+// Work out the chunk layout: how many entities fit in a chunk and where each column starts
+//
+ECSArchetype::ECSArchetype( const Array<uint32> &componentIDsIn, const ECSComponentMask &doubleBufferedIn, uint32 indexIn,
+	ECSChunkAllocator &chunkAllocatorIn, const uint32 &changeVersionIn ) :
+	componentIDs( componentIDsIn ), index( indexIn ), numDoubleBuffered( 0 ),
+	entityOffset( sizeof( uint32 ) * componentIDsIn.size() ), numEntities( 0 ),
+	chunkAllocator( chunkAllocatorIn ), changeVersion( changeVersionIn )
+{
+	// each entity needs its handle plus one of each component (or each field of a SoA component),
+	// and a second one of each double buffered component.
+	// Worst case, every column (or field stream) needs (alignment-1) bytes of padding to line up
+	size_t rowSize = sizeof( EntityHandle );
+	size_t padding = entityOffset;	// the column versions come first
+	for (uint32 i = 0; i < componentIDs.size(); i++)
+	{
+		const ECSComponentFieldList *fields = BaseECSComponent::getTypeFields( componentIDs[i] );
+		if (fields == nullptr)
+		{
+			uint32 numCopies = doubleBufferedIn.test( componentIDs[i] ) ? 2 : 1;
+			rowSize += BaseECSComponent::getTypeSize( componentIDs[i] ) * numCopies;
+			padding += BaseECSComponent::getTypeAlignment( componentIDs[i] ) * numCopies;
+			continue;
+		}
+		for (uint32 j = 0; j < fields->size(); j++)
+		{
+			rowSize += (*fields)[j].size;
+			padding += Math::max( (*fields)[j].alignment, (size_t)ECS_SOA_STREAM_ALIGNMENT );
+		}
+	}
+
+	chunkSize = ECS_CHUNK_SIZE;
+	chunkCapacity = (uint32)((chunkSize - Math::min( padding, chunkSize )) / rowSize);
+	if (chunkCapacity == 0)
+	{	// huge components, make the chunk big enough for a single entity
+		chunkCapacity = 1;
+		chunkSize = rowSize + padding;
+	}
+
+	// lay the columns out back to back, and index them by component ID so looking up
+	// a component doesn't need to search the archetype's component list
+	columnLookup.resize( BaseECSComponent::getNumTypes(), -1 );
+	size_t offset = entityOffset + sizeof( EntityHandle ) * chunkCapacity;
+	for (uint32 i = 0; i < componentIDs.size(); i++)
+	{
+		columnLookup[componentIDs[i]] = (int32)i;
+		mask.set( componentIDs[i] );
+		size_t typeSize = BaseECSComponent::getTypeSize( componentIDs[i] );
+		columnSizes.push_back( typeSize );
+
+		// leave out the functions we don't need to call, so moving and freeing can skip them
+		uint32 typeFlags = BaseECSComponent::getTypeFlags( componentIDs[i] );
+		columnRelocateFuncs.push_back( (typeFlags & ECS_COMPONENT_TRIVIALLY_COPYABLE) ?
+			nullptr : BaseECSComponent::getTypeRelocateFunction( componentIDs[i] ) );
+		columnFreeFuncs.push_back( (typeFlags & ECS_COMPONENT_TRIVIALLY_DESTRUCTIBLE) ?
+			nullptr : BaseECSComponent::getTypeFreeFunction( componentIDs[i] ) );
+
+		// a SoA column is a stream for each field instead
+		const ECSComponentFieldList *fields = BaseECSComponent::getTypeFields( componentIDs[i] );
+		columnFields.push_back( fields );
+		columnFirstStream.push_back( (uint32)streamOffsets.size() );
+		if (fields == nullptr)
+		{
+			offset = Memory::align( offset, BaseECSComponent::getTypeAlignment( componentIDs[i] ) );
+			columnOffsets.push_back( offset );
+			offset += typeSize * chunkCapacity;
+			continue;
+		}
+
+		columnOffsets.push_back( 0 );
+		for (uint32 j = 0; j < fields->size(); j++)
+		{
+			offset = Memory::align( offset, Math::max( (*fields)[j].alignment, (size_t)ECS_SOA_STREAM_ALIGNMENT ) );
+			streamOffsets.push_back( offset );
+			offset += (*fields)[j].size * chunkCapacity;
+		}
+	}
+
+	// then the previous copies of the double buffered columns
+	previousOffsets.resize( componentIDs.size(), 0 );
+	for (uint32 i = 0; i < componentIDs.size(); i++)
+	{
+		if (!doubleBufferedIn.test( componentIDs[i] ) || columnFields[i] != nullptr)
+		{
+			continue;
+		}
+		offset = Memory::align( offset, BaseECSComponent::getTypeAlignment( componentIDs[i] ) );
+		previousOffsets[i] = offset;
+		offset += columnSizes[i] * chunkCapacity;
+		numDoubleBuffered++;
+	}
+	assertCheck( offset <= chunkSize );
+
+	// big enough for the largest component, with room to line it up
+	size_t largestSize = 0;
+	for (uint32 i = 0; i < columnSizes.size(); i++)
+	{
+		largestSize = Math::max( largestSize, columnSizes[i] );
+	}
+	swapBuffer.resize( largestSize + ECS_CHUNK_ALIGNMENT );
+}
+
+//
+// Double buffered types are trivially copyable, so a column is copied in one go
+//
+void ECSArchetype::copyToPrevious( uint32 sinceVersion )
+{
+	if (numDoubleBuffered == 0)
+	{
+		return;
+	}
+	for (uint32 i = 0; i < chunks.size(); i++)
+	{
+		for (uint32 j = 0; j < componentIDs.size(); j++)
+		{
+			if (isDoubleBuffered( j ) && getColumnVersion( chunks[i], j ) > sinceVersion)
+			{
+				Memory::memcpy( getPreviousColumn( chunks[i], j ), getColumn( chunks[i], j ),
+					columnSizes[j] * chunks[i].numEntities );
+			}
+		}
+	}
+}
+
+//
+// Construct a copy of the prototype in the row.  A SoA component is split up into its field streams
+//
+void ECSArchetype::createComponent( uint32 row, uint32 column, EntityHandle entity, BaseECSComponent *prototype )
+{
+	if (columnFields[column] == nullptr)
+	{
+		BaseECSComponent::getTypeCreateFunction( componentIDs[column] )( getComponent( row, column ), entity, prototype );
+		markChanged( row, column );
+		return;
+	}
+
+	writeComponent( row, column, prototype );
+}
+
+//
+// Split a SoA component up into its field streams
+//
+void ECSArchetype::writeComponent( uint32 row, uint32 column, const BaseECSComponent *component )
+{
+	assertCheck( columnFields[column] != nullptr );
+	ECSChunk &chunk = chunks[row / chunkCapacity];
+	uint32 slot = row % chunkCapacity;
+	const ECSComponentFieldList &fields = *columnFields[column];
+	for (uint32 i = 0; i < fields.size(); i++)
+	{
+		Memory::memcpy( getFieldStream( chunk, column, i ) + slot * fields[i].size,
+			(const uint8*)component + fields[i].offset, fields[i].size );
+	}
+	markChanged( row, column );
+}
+
+//
+// Gather the fields of a SoA component back into a whole component
+//
+void ECSArchetype::readComponent( uint32 row, uint32 column, BaseECSComponent *component )
+{
+	assertCheck( columnFields[column] != nullptr );
+	ECSChunk &chunk = chunks[row / chunkCapacity];
+	uint32 slot = row % chunkCapacity;
+	const ECSComponentFieldList &fields = *columnFields[column];
+	for (uint32 i = 0; i < fields.size(); i++)
+	{
+		Memory::memcpy( (uint8*)component + fields[i].offset,
+			getFieldStream( chunk, column, i ) + slot * fields[i].size, fields[i].size );
+	}
+	component->entity = getEntities( chunk )[slot];
+}
+
+//
+// Copy the fields of a SoA component from one row to another (possibly in another archetype)
+//
+void ECSArchetype::copyFields( ECSArchetype &src, uint32 srcRow, uint32 srcColumn,
+	ECSArchetype &dest, uint32 destRow, uint32 destColumn )
+{
+	ECSChunk &srcChunk = src.chunks[srcRow / src.chunkCapacity];
+	ECSChunk &destChunk = dest.chunks[destRow / dest.chunkCapacity];
+	uint32 srcSlot = srcRow % src.chunkCapacity;
+	uint32 destSlot = destRow % dest.chunkCapacity;
+	const ECSComponentFieldList &fields = *src.columnFields[srcColumn];
+	for (uint32 i = 0; i < fields.size(); i++)
+	{
+		Memory::memcpy( dest.getFieldStream( destChunk, destColumn, i ) + destSlot * fields[i].size,
+			src.getFieldStream( srcChunk, srcColumn, i ) + srcSlot * fields[i].size, fields[i].size );
+	}
+}
+
+ECSArchetype::~ECSArchetype()
+{
+	clear();
+}
+
+//
+// free all the components still in the archetype, then the chunks themselves.
+// Columns which don't need freeing are skipped entirely
+//
+void ECSArchetype::clear()
+{
+	for (uint32 i = 0; i < chunks.size(); i++)
+	{
+		for (uint32 j = 0; j < componentIDs.size(); j++)
+		{
+			ECSComponentFreeFunc freefn = columnFreeFuncs[j];
+			if (freefn == nullptr)
+			{
+				continue;
+			}
+			uint8 *column = getColumn( chunks[i], j );
+			for (uint32 k = 0; k < chunks[i].numEntities; k++)
+			{
+				freefn( (BaseECSComponent*)(column + k * columnSizes[j]) );
+			}
+		}
+		chunkAllocator.free( chunks[i].memory, chunkSize );
+	}
+	chunks.clear();
+	numEntities = 0;
+}
+
+//
+// Add a row for the entity at the end of the archetype, allocating a new chunk if the last one is full
+//
+uint32 ECSArchetype::addRow( EntityHandle entity )
+{
+	uint32 row = numEntities;
+	if (row == chunks.size() * chunkCapacity)
+	{
+		ECSChunk newChunk;
+		newChunk.memory = chunkAllocator.allocate( chunkSize );
+		chunks.push_back( newChunk );
+	}
+
+	ECSChunk &chunk = chunks[row / chunkCapacity];
+	getEntities( chunk )[chunk.numEntities] = entity;
+	chunk.numEntities++;
+	numEntities++;
+	markRowChanged( row );
+	return row;
+}
+
+//
+// Fill the chunks up a run of rows at a time, stamping each chunk once instead of once per row
+//
+uint32 ECSArchetype::addRows( const EntityHandle *newEntities, uint32 count )
+{
+	uint32 firstRow = numEntities;
+	while (count > 0)
+	{
+		if (numEntities == chunks.size() * chunkCapacity)
+		{
+			ECSChunk newChunk;
+			newChunk.memory = chunkAllocator.allocate( chunkSize );
+			chunks.push_back( newChunk );
+		}
+
+		ECSChunk &chunk = chunks.back();
+		uint32 numRows = Math::min( count, chunkCapacity - chunk.numEntities );
+		Memory::memcpy( getEntities( chunk ) + chunk.numEntities, newEntities, numRows * sizeof( EntityHandle ) );
+		uint32 *versions = getColumnVersions( chunk );
+		for (uint32 i = 0; i < componentIDs.size(); i++)
+		{
+			versions[i] = changeVersion;
+		}
+		chunk.numEntities += numRows;
+		numEntities += numRows;
+		newEntities += numRows;
+		count -= numRows;
+	}
+	return firstRow;
+}
+
+//
+// Copy the value into the first slot, then keep copying everything filled so far
+//
+void ECSArchetype::fillBytes( uint8 *dest, const void *value, size_t size, uint32 count )
+{
+	if (count == 0)
+	{
+		return;
+	}
+	Memory::memcpy( dest, value, size );
+	for (uint32 numFilled = 1; numFilled < count;)
+	{
+		uint32 numCopied = Math::min( numFilled, count - numFilled );
+		Memory::memcpy( dest + numFilled * size, dest, numCopied * size );
+		numFilled += numCopied;
+	}
+}
+
+void ECSArchetype::fillComponents( uint32 firstRow, uint32 numRows, uint32 column, const BaseECSComponent *prototype )
+{
+	bool isTrivial = (BaseECSComponent::getTypeFlags( componentIDs[column] ) & ECS_COMPONENT_TRIVIALLY_COPYABLE) != 0;
+	ECSComponentCreateFunc createfn = BaseECSComponent::getTypeCreateFunction( componentIDs[column] );
+	for (uint32 row = firstRow; row < firstRow + numRows;)
+	{
+		ECSChunk &chunk = chunks[row / chunkCapacity];
+		uint32 slot = row % chunkCapacity;
+		uint32 count = Math::min( firstRow + numRows - row, chunkCapacity - slot );
+		EntityHandle *rowEntities = getEntities( chunk ) + slot;
+		if (columnFields[column] != nullptr)
+		{	// the entity isn't one of the fields, so the streams are just the prototype's values
+			const ECSComponentFieldList &fields = *columnFields[column];
+			for (uint32 i = 0; i < fields.size(); i++)
+			{
+				fillBytes( getFieldStream( chunk, column, i ) + slot * fields[i].size,
+					(const uint8*)prototype + fields[i].offset, fields[i].size, count );
+			}
+		}
+		else if (isTrivial)
+		{
+			uint8 *components = getColumn( chunk, column ) + slot * columnSizes[column];
+			fillBytes( components, prototype, columnSizes[column], count );
+			for (uint32 i = 0; i < count; i++)
+			{
+				((BaseECSComponent*)(components + i * columnSizes[column]))->entity = rowEntities[i];
+			}
+		}
+		else
+		{
+			uint8 *components = getColumn( chunk, column ) + slot * columnSizes[column];
+			for (uint32 i = 0; i < count; i++)
+			{
+				createfn( components + i * columnSizes[column], rowEntities[i], (BaseECSComponent*)prototype );
+			}
+		}
+		getColumnVersions( chunk )[column] = changeVersion;
+		row += count;
+	}
+}
+
+ECSChunk &ECSArchetype::addChunk( uint32 numRows )
+{
+	assertCheck( numRows <= chunkCapacity && numEntities == chunks.size() * chunkCapacity );
+	ECSChunk newChunk;
+	newChunk.memory = chunkAllocator.allocate( chunkSize );
+	newChunk.numEntities = numRows;
+	chunks.push_back( newChunk );
+	numEntities += numRows;
+	return chunks.back();
+}
+
+//
+// Swap the components a column at a time, moving one of them out of the way into the swap buffer
+//
+void ECSArchetype::swapRows( uint32 firstRow, uint32 secondRow )
+{
+	if (firstRow == secondRow)
+	{
+		return;
+	}
+
+	uint8 *temp = Memory::align( swapBuffer.data(), ECS_CHUNK_ALIGNMENT );
+	for (uint32 i = 0; i < componentIDs.size(); i++)
+	{
+		if (columnFields[i] != nullptr)
+		{	// SoA components are trivially copyable, so the whole component can go through the buffer
+			readComponent( firstRow, i, (BaseECSComponent*)temp );
+			copyFields( *this, secondRow, i, *this, firstRow, i );
+			writeComponent( secondRow, i, (BaseECSComponent*)temp );
+			continue;
+		}
+
+		BaseECSComponent *first = getComponent( firstRow, i );
+		BaseECSComponent *second = getComponent( secondRow, i );
+		relocateComponent( i, temp, first );
+		relocateComponent( i, first, second );
+		relocateComponent( i, second, (BaseECSComponent*)temp );
+	}
+
+	ECSChunk &firstChunk = chunks[firstRow / chunkCapacity];
+	ECSChunk &secondChunk = chunks[secondRow / chunkCapacity];
+	std::swap( getEntities( firstChunk )[firstRow % chunkCapacity], getEntities( secondChunk )[secondRow % chunkCapacity] );
+	markRowChanged( firstRow );
+	markRowChanged( secondRow );
+}
+
+//
+// Remove the row by copying the last row of the archetype over it (swap places in the list).
+// Since we moved the last entity, return it so the caller can update where it lives.
+//
+EntityHandle ECSArchetype::removeRow( uint32 row, bool freeComponents )
+{
+	uint32 lastRow = numEntities - 1;
+	ECSChunk &chunk = chunks[row / chunkCapacity];
+	ECSChunk &lastChunk = chunks[lastRow / chunkCapacity];
+	uint32 slot = row % chunkCapacity;
+	uint32 lastSlot = lastRow % chunkCapacity;
+
+	for (uint32 i = 0; i < componentIDs.size(); i++)
+	{
+		if (columnFields[i] != nullptr)
+		{	// SoA components never need freeing
+			if (row != lastRow)
+			{
+				copyFields( *this, lastRow, i, *this, row, i );
+			}
+			continue;
+		}
+
+		BaseECSComponent *destComponent = (BaseECSComponent*)(getColumn( chunk, i ) + slot * columnSizes[i]);
+		if (freeComponents)
+		{
+			freeComponent( i, destComponent );
+		}
+		if (row != lastRow)
+		{
+			relocateComponent( i, destComponent, (BaseECSComponent*)(getColumn( lastChunk, i ) + lastSlot * columnSizes[i]) );
+		}
+	}
+
+	EntityHandle movedEntity = NULL_ENTITY_HANDLE;
+	if (row != lastRow)
+	{
+		movedEntity = getEntities( lastChunk )[lastSlot];
+		getEntities( chunk )[slot] = movedEntity;
+		markRowChanged( row );
+	}
+
+	lastChunk.numEntities--;
+	numEntities--;
+	if (lastChunk.numEntities == 0)
+	{
+		chunkAllocator.free( lastChunk.memory, chunkSize );
+		chunks.pop_back();
+	}
+
+	return movedEntity;
+}
+
+//
+// Both component ID lists are sorted, so walk them together:
+// matching columns are copied across and the columns the destination doesn't have are freed
+//
+void ECSArchetype::moveComponents( ECSArchetype &src, uint32 srcRow, ECSArchetype &dest, uint32 destRow )
+{
+	uint32 j = 0;
+	for (uint32 i = 0; i < src.componentIDs.size(); i++)
+	{
+		uint32 componentID = src.componentIDs[i];
+		while (j < dest.componentIDs.size() && dest.componentIDs[j] < componentID)
+		{
+			j++;
+		}
+
+		bool isShared = j < dest.componentIDs.size() && dest.componentIDs[j] == componentID;
+		if (src.columnFields[i] != nullptr)
+		{
+			if (isShared)
+			{
+				copyFields( src, srcRow, i, dest, destRow, j );
+			}
+			continue;
+		}
+
+		BaseECSComponent *srcComponent = src.getComponent( srcRow, i );
+		if (isShared)
+		{
+			src.relocateComponent( i, dest.getComponent( destRow, j ), srcComponent );
+		}
+		else
+		{
+			src.freeComponent( i, srcComponent );
+		}
+	}
+}
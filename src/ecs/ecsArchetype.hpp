@@ -0,0 +1,244 @@
+#pragma once
+//
+// An ARCHETYPE holds every entity that has exactly the same set of component types.
+// The entities are packed into fixed size chunks, and inside a chunk each component type
+// gets its own contiguous column, so a system iterating an archetype walks tightly packed
+// memory instead of hopping between unrelated component blocks.
+//
+// Chunk layout (capacity N):
+// [ version of each column ][ N entity handles ][ N components of type 0 ][ N components of type 1 ] ...
+//
+// A column's version is the ECS change version from the last time anything in the column was
+// written, so systems can skip chunks which haven't changed since they last looked at them.
+//
+// Component types with a SoA layout get a stream per field instead of a column of components:
+// [ versions ][ N entity handles ][ N of field 0 of type 0 ][ N of field 1 of type 0 ][ N components of type 1 ] ...
+//
+// Double buffered component types get a second column after all the others, holding a copy of the
+// components from the last copyToPrevious, so something can read the last frame while the next
+// one is being written:
+// [ versions ][ N entity handles ][ N of type 0 ][ N of type 1 ][ N of type 1 from the last copy ]
+//
+#include "ecsComponent.hpp"
+#include "dataStructures/array.hpp"
+#include "core/common.hpp"
+#include "core/memory.hpp"
+
+#define ECS_CHUNK_SIZE (16 * 1024)
+#define ECS_CHUNK_ALIGNMENT 64		// start every chunk on a cache line
+#define ECS_CHUNKS_PER_BLOCK 16		// chunks are allocated from the system this many at a time
+#define ECS_SOA_STREAM_ALIGNMENT 16	// field streams of SoA components start on a SIMD boundary
+
+struct ECSChunk
+{
+	uint8 *memory = nullptr;
+	uint32 numEntities = 0;
+};
+
+//
+// Hands out chunk memory to all the archetypes of an ECS.
+// Chunks are carved out of large blocks, and a freed chunk goes on a free list for the next
+// archetype which needs one, so entities going back and forth over a chunk boundary (or moving
+// between archetypes) don't keep going to the system allocator.
+// Chunks larger than ECS_CHUNK_SIZE (for huge components) are allocated on their own.
+//
+class ECSChunkAllocator
+{
+public:
+	ECSChunkAllocator() {}
+	~ECSChunkAllocator();
+
+	uint8 *allocate( size_t size );
+	void free( uint8 *memory, size_t size );
+
+	size_t getNumFreeChunks() const { return numFreeChunks; }
+	size_t getNumBlocks() const { return blocks.size(); }
+
+	// gives the blocks which are entirely free back to the system. Returns the number of blocks released
+	size_t releaseFreeBlocks();
+
+private:
+	Array<uint8*> blocks;
+	uint8 *freeList = nullptr;		// each free chunk holds a pointer to the next one
+	size_t numFreeChunks = 0;
+
+	size_t findBlock( uint8 *chunk ) const;
+
+	NULL_COPY_AND_ASSIGN( ECSChunkAllocator );
+};
+
+class ECSArchetype
+{
+public:
+	// componentIDs must be sorted and contain no duplicates, and the double buffered types have to be
+	// trivially copyable without a SoA layout.
+	// Rows added and components written are stamped with the current value of changeVersion
+	ECSArchetype( const Array<uint32> &componentIDsIn, const ECSComponentMask &doubleBufferedIn, uint32 indexIn,
+		ECSChunkAllocator &chunkAllocatorIn, const uint32 &changeVersionIn );
+	~ECSArchetype();
+
+	const Array<uint32> &getComponentIDs() const { return componentIDs; }
+	const ECSComponentMask &getMask() const { return mask; }
+	uint32 getIndex() const { return index; }		// where the archetype is in its ECS's list of archetypes
+	uint32 getNumEntities() const { return numEntities; }
+	uint32 getChunkCapacity() const { return chunkCapacity; }
+	size_t getChunkSize() const { return chunkSize; }
+	size_t getNumChunks() const { return chunks.size(); }
+	ECSChunk &getChunk( size_t index ) { return chunks[index]; }
+
+	// returns the column holding the component type, or -1 if the archetype doesn't have it
+	int32 getColumnIndex( uint32 componentID ) const
+	{
+		return componentID < columnLookup.size() ? columnLookup[componentID] : -1;
+	}
+	bool hasComponent( uint32 componentID ) const { return getColumnIndex( componentID ) >= 0; }
+
+	// column access within a chunk
+	EntityHandle *getEntities( ECSChunk &chunk ) { return (EntityHandle*)(chunk.memory + entityOffset); }
+	uint8 *getColumn( ECSChunk &chunk, uint32 column ) { return chunk.memory + columnOffsets[column]; }
+	size_t getColumnStride( uint32 column ) const { return columnSizes[column]; }
+
+	// the copy of a double buffered column from the last copyToPrevious
+	bool isDoubleBuffered( uint32 column ) const { return previousOffsets[column] != 0; }
+	bool hasDoubleBuffered() const { return numDoubleBuffered > 0; }
+	uint8 *getPreviousColumn( ECSChunk &chunk, uint32 column ) { return chunk.memory + previousOffsets[column]; }
+
+	// copies the double buffered columns which were written after sinceVersion into their previous columns
+	void copyToPrevious( uint32 sinceVersion );
+
+	// the change version of each column in the chunk
+	uint32 *getColumnVersions( ECSChunk &chunk ) { return (uint32*)chunk.memory; }
+	uint32 getColumnVersion( ECSChunk &chunk, uint32 column ) { return getColumnVersions( chunk )[column]; }
+
+	// call after writing to a component through a pointer, so systems watching the column see the change
+	void markChanged( uint32 row, uint32 column )
+	{
+		getColumnVersions( chunks[row / chunkCapacity] )[column] = changeVersion;
+	}
+
+	// SoA columns don't hold whole components, just a stream for each field
+	bool isSoAColumn( uint32 column ) const { return columnFields[column] != nullptr; }
+	const ECSComponentFieldList *getColumnFields( uint32 column ) const { return columnFields[column]; }
+	uint8 *getFieldStream( ECSChunk &chunk, uint32 column, uint32 field )
+	{
+		return chunk.memory + streamOffsets[columnFirstStream[column] + field];
+	}
+
+	// access by row, where a row is the index of the entity within the whole archetype.
+	// Not for SoA columns
+	BaseECSComponent *getComponent( uint32 row, uint32 column )
+	{
+		assertCheck( columnFields[column] == nullptr );
+		ECSChunk &chunk = chunks[row / chunkCapacity];
+		return (BaseECSComponent*)(getColumn( chunk, column ) + (row % chunkCapacity) * columnSizes[column]);
+	}
+	// the same for a type known at compile time, so the stride is a constant
+	template<class Component>
+	Component *getComponent( uint32 row, uint32 column )
+	{
+		assertCheck( columnFields[column] == nullptr && columnSizes[column] == sizeof( Component ) );
+		return (Component*)getColumn( chunks[row / chunkCapacity], column ) + row % chunkCapacity;
+	}
+	EntityHandle getEntity( uint32 row )
+	{
+		return getEntities( chunks[row / chunkCapacity] )[row % chunkCapacity];
+	}
+
+	// makes room in the chunk list for numRows rows, so adding lots of rows doesn't keep growing it
+	void reserve( uint32 numRows ) { chunks.reserve( (numRows + chunkCapacity - 1) / chunkCapacity ); }
+
+	// frees every component and chunk
+	void clear();
+
+	// constructs a copy of the prototype in the row, for any layout
+	void createComponent( uint32 row, uint32 column, EntityHandle entity, BaseECSComponent *prototype );
+
+	// copy a SoA component out of (or into) the row
+	void readComponent( uint32 row, uint32 column, BaseECSComponent *component );
+	void writeComponent( uint32 row, uint32 column, const BaseECSComponent *component );
+
+	// reserves a row at the end of the archetype for the entity, components are left unconstructed
+	uint32 addRow( EntityHandle entity );
+
+	// reserves rows at the end of the archetype for all the entities, returns the first of them
+	uint32 addRows( const EntityHandle *newEntities, uint32 count );
+
+	// constructs copies of the prototype in a run of rows, for any layout.  Types which can be memcpy'd
+	// are copied into each chunk's part of the run with a few doubling memcpys
+	void fillComponents( uint32 firstRow, uint32 numRows, uint32 column, const BaseECSComponent *prototype );
+
+	// adds a chunk holding numRows rows at the end of the archetype, for filling in with whole chunks
+	// of data (entities, column versions and all).  Only the last chunk can be partly full
+	ECSChunk &addChunk( uint32 numRows );
+
+	// swaps two rows, entities and all
+	void swapRows( uint32 firstRow, uint32 secondRow );
+
+	// removes a row by moving the last row into its place.
+	// Returns the entity which was moved into the row, or NULL_ENTITY_HANDLE if nothing moved.
+	EntityHandle removeRow( uint32 row, bool freeComponents );
+
+	// moves the components of an entity into another archetype.  Components the destination
+	// doesn't have are freed, components only the destination has are left for the caller to create.
+	// The source row still has to be removed afterwards with removeRow( srcRow, false ).
+	static void moveComponents( ECSArchetype &src, uint32 srcRow, ECSArchetype &dest, uint32 destRow );
+
+private:
+	Array<uint32> componentIDs;		// sorted component IDs, one column per ID
+	ECSComponentMask mask;			// the same component IDs as a mask
+	uint32 index;
+	Array<size_t> columnOffsets;	// byte offset of each column from the start of a chunk
+	Array<size_t> columnSizes;		// size of a single component in each column
+	Array<size_t> previousOffsets;	// byte offset of the previous copy of each column, 0 if it isn't double buffered
+	uint32 numDoubleBuffered;
+	Array<ECSComponentRelocateFunc> columnRelocateFuncs;	// null if the components can be memcpy'd
+	Array<ECSComponentFreeFunc> columnFreeFuncs;			// null if the components don't need freeing
+	Array<const ECSComponentFieldList*> columnFields;		// null unless the column has a SoA layout
+	Array<uint32> columnFirstStream;	// index of the first field stream of each SoA column
+	Array<size_t> streamOffsets;		// byte offset of each field stream from the start of a chunk
+	Array<int32> columnLookup;		// column of every registered component type (-1 if not in the archetype)
+	size_t entityOffset;
+	size_t chunkSize;
+	uint32 chunkCapacity;			// number of entities which fit in one chunk
+	uint32 numEntities;
+	Array<ECSChunk> chunks;			// every chunk is full except for the last one
+	Array<uint8> swapBuffer;		// holds one component while swapping rows
+	ECSChunkAllocator &chunkAllocator;
+	const uint32 &changeVersion;
+
+	void markRowChanged( uint32 row )
+	{
+		uint32 *versions = getColumnVersions( chunks[row / chunkCapacity] );
+		for (uint32 i = 0; i < componentIDs.size(); i++)
+		{
+			versions[i] = changeVersion;
+		}
+	}
+
+	static void fillBytes( uint8 *dest, const void *value, size_t size, uint32 count );
+
+	static void copyFields( ECSArchetype &src, uint32 srcRow, uint32 srcColumn,
+		ECSArchetype &dest, uint32 destRow, uint32 destColumn );
+
+	void relocateComponent( uint32 column, void *dest, BaseECSComponent *src )
+	{
+		if (columnRelocateFuncs[column] == nullptr)
+		{
+			Memory::memcpy( dest, src, columnSizes[column] );
+		}
+		else
+		{
+			columnRelocateFuncs[column]( dest, src );
+		}
+	}
+
+	void freeComponent( uint32 column, BaseECSComponent *component )
+	{
+		if (columnFreeFuncs[column] != nullptr)
+		{
+			columnFreeFuncs[column]( component );
+		}
+	}
+
+	NULL_COPY_AND_ASSIGN( ECSArchetype );
+};
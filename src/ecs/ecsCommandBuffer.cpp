@@ -0,0 +1,279 @@
+#include <utility>
+#include "core/memory.hpp"
+#include "math/math.hpp"
+#include "ecsCommandBuffer.hpp"
+#include "ecs.hpp"
+
+#define ECS_COMMAND_BUFFER_ALIGNMENT 64		// the data is aligned to this, or more for components which need it
+
+ECSCommandBuffer::~ECSCommandBuffer()
+{
+	clear();
+	if (data != nullptr)
+	{
+		Memory::free( data );
+	}
+}
+
+void ECSCommandBuffer::makeEntity( BaseECSComponent **entityComponents, const uint32 *componentIDs,
+	size_t numComponents )
+{
+	for (uint32 i = 0; i < numComponents; i++)
+	{
+		if (!BaseECSComponent::isTypeValid( componentIDs[i] ))
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "%u is not a valid component type", componentIDs[i] );
+			return;
+		}
+	}
+
+	std::unique_lock<std::mutex> lock( mutex );
+	Command command;
+	command.type = COMMAND_MAKE_ENTITY;
+	command.entity = NULL_ENTITY_HANDLE;
+	command.firstComponent = (uint32)components.size();
+	command.numComponents = (uint32)numComponents;
+	command.componentID = 0;
+	for (uint32 i = 0; i < numComponents; i++)
+	{
+		bufferComponent( componentIDs[i], entityComponents[i] );
+	}
+	commands.push_back( command );
+}
+
+void ECSCommandBuffer::removeEntity( EntityHandle handle )
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	removedEntities.push_back( handle );
+}
+
+void ECSCommandBuffer::addComponentByType( EntityHandle handle, uint32 componentID, const BaseECSComponent *component )
+{
+	if (!BaseECSComponent::isTypeValid( componentID ))
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "%u is not a valid component type", componentID );
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock( mutex );
+	Command command;
+	command.type = COMMAND_ADD_COMPONENT;
+	command.entity = handle;
+	command.firstComponent = (uint32)components.size();
+	command.numComponents = 1;
+	command.componentID = componentID;
+	bufferComponent( componentID, component );
+	commands.push_back( command );
+}
+
+void ECSCommandBuffer::removeComponentByType( EntityHandle handle, uint32 componentID )
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	Command command;
+	command.type = COMMAND_REMOVE_COMPONENT;
+	command.entity = handle;
+	command.firstComponent = 0;
+	command.numComponents = 0;
+	command.componentID = componentID;
+	commands.push_back( command );
+}
+
+//
+// Copy the component onto the end of the data, growing it if needed
+//
+void ECSCommandBuffer::bufferComponent( uint32 componentID, const BaseECSComponent *component )
+{
+	size_t size = BaseECSComponent::getTypeSize( componentID );
+	size_t alignment = BaseECSComponent::getTypeAlignment( componentID );
+	size_t offset = Memory::align( dataSize, alignment );
+	// the offsets are only aligned if the data is aligned to at least as much
+	if (offset + size > dataCapacity || alignment > dataAlignment)
+	{
+		size_t newCapacity = Math::max( Math::max( dataCapacity * 2, offset + size ), (size_t)1024 );
+		size_t newAlignment = Math::max( Math::max( dataAlignment, alignment ), (size_t)ECS_COMMAND_BUFFER_ALIGNMENT );
+		uint8 *newData = (uint8*)Memory::malloc( newCapacity, (uint32)newAlignment );
+		if (data != nullptr)
+		{
+			relocateComponents( newData );
+			Memory::free( data );
+		}
+		data = newData;
+		dataCapacity = newCapacity;
+		dataAlignment = newAlignment;
+	}
+
+	BaseECSComponent::getTypeCreateFunction( componentID )( data + offset, NULL_ENTITY_HANDLE,
+		(BaseECSComponent*)component );
+	dataSize = offset + size;
+
+	BufferedComponent bufferedComponent;
+	bufferedComponent.componentID = componentID;
+	bufferedComponent.offset = offset;
+	components.push_back( bufferedComponent );
+}
+
+//
+// Move the buffered components into new memory (at the same offsets)
+//
+void ECSCommandBuffer::relocateComponents( uint8 *newData )
+{
+	for (uint32 i = 0; i < components.size(); i++)
+	{
+		uint32 componentID = components[i].componentID;
+		uint8 *newComponent = newData + components[i].offset;
+		if (BaseECSComponent::getTypeFlags( componentID ) & ECS_COMPONENT_TRIVIALLY_COPYABLE)
+		{
+			Memory::memcpy( newComponent, getBufferedComponent( i ), BaseECSComponent::getTypeSize( componentID ) );
+		}
+		else
+		{
+			BaseECSComponent::getTypeRelocateFunction( componentID )( newComponent, getBufferedComponent( i ) );
+		}
+	}
+}
+
+//
+// Trade everything recorded (and the memory for it) with another buffer
+//
+void ECSCommandBuffer::swapRecording( ECSCommandBuffer &other )
+{
+	commands.swap( other.commands );
+	components.swap( other.components );
+	removedEntities.swap( other.removedEntities );
+	std::swap( data, other.data );
+	std::swap( dataSize, other.dataSize );
+	std::swap( dataCapacity, other.dataCapacity );
+	std::swap( dataAlignment, other.dataAlignment );
+}
+
+void ECSCommandBuffer::clear()
+{
+	for (uint32 i = 0; i < components.size(); i++)
+	{
+		if ((BaseECSComponent::getTypeFlags( components[i].componentID ) & ECS_COMPONENT_TRIVIALLY_DESTRUCTIBLE) == 0)
+		{
+			BaseECSComponent::getTypeFreeFunction( components[i].componentID )( getBufferedComponent( i ) );
+		}
+	}
+	commands.clear();
+	components.clear();
+	removedEntities.clear();
+	dataSize = 0;
+}
+
+//
+// Each buffer's recording is swapped out under its lock and applied from outside it, since the ECS
+// notifies listeners as it goes and they may record into the buffers again
+//
+void ECSCommandBuffer::apply( ECS &ecs, ECSCommandBuffer **buffers, size_t numBuffers )
+{
+	ECSCommandBuffer recorded;
+	Array<BaseECSComponent*> componentParam;
+	Array<uint32> componentIDs;
+	Array<EntityHandle> removedEntities;
+	for (uint32 i = 0; i < numBuffers; i++)
+	{
+		{
+			std::unique_lock<std::mutex> lock( buffers[i]->mutex );
+			buffers[i]->swapRecording( recorded );
+		}
+		recorded.applyChanges( ecs, componentParam, componentIDs );
+		// every removal at once at the end, so the ECS can sort them
+		removedEntities.insert( removedEntities.end(), recorded.removedEntities.begin(),
+			recorded.removedEntities.end() );
+		recorded.clear();
+
+		// give the memory back unless the buffer has had to allocate its own since
+		std::unique_lock<std::mutex> lock( buffers[i]->mutex );
+		if (buffers[i]->data == nullptr)
+		{
+			std::swap( buffers[i]->data, recorded.data );
+			std::swap( buffers[i]->dataCapacity, recorded.dataCapacity );
+			std::swap( buffers[i]->dataAlignment, recorded.dataAlignment );
+		}
+	}
+
+	if (!removedEntities.empty())
+	{
+		ecs.removeEntities( &removedEntities[0], removedEntities.size() );
+	}
+}
+
+//
+// Everything but the removals, on a buffer nothing else can see.  The ECS copies the buffered
+// components, clear() frees them afterwards.  Consecutive makes of entities with the same component
+// types (in the same order) go to the ECS as a single makeEntities
+//
+void ECSCommandBuffer::applyChanges( ECS &ecs, Array<BaseECSComponent*> &componentParam, Array<uint32> &componentIDs )
+{
+	for (uint32 i = 0; i < commands.size(); i++)
+	{
+		Command &command = commands[i];
+		switch (command.type)
+		{
+		case COMMAND_MAKE_ENTITY:
+		{
+			componentParam.clear();
+			componentIDs.clear();
+			for (uint32 j = command.firstComponent; j < command.firstComponent + command.numComponents; j++)
+			{
+				componentParam.push_back( getBufferedComponent( j ) );
+				componentIDs.push_back( components[j].componentID );
+			}
+			uint32 numEntities = 1;
+			while (i + numEntities < commands.size() && isSameMake( command, commands[i + numEntities] ))
+			{
+				numEntities++;
+			}
+			if (numEntities == 1)
+			{
+				ecs.makeEntity( componentParam.data(), componentIDs.data(), command.numComponents );
+				break;
+			}
+
+			// a run of entities with the same components is made in one go from the first one's components,
+			// and the rest get theirs copied over them
+			uint32 firstCommand = i;
+			ecs.makeEntities( numEntities, componentParam.data(), componentIDs.data(), command.numComponents, nullptr,
+				[this, firstCommand]( uint32 index, EntityHandle handle, BaseECSComponent **newComponents )
+			{
+				const Command &entityCommand = commands[firstCommand + index];
+				for (uint32 j = 0; j < entityCommand.numComponents && index > 0; j++)
+				{
+					uint32 componentID = components[entityCommand.firstComponent + j].componentID;
+					if ((BaseECSComponent::getTypeFlags( componentID ) & ECS_COMPONENT_TRIVIALLY_DESTRUCTIBLE) == 0)
+					{
+						BaseECSComponent::getTypeFreeFunction( componentID )( newComponents[j] );
+					}
+					BaseECSComponent::getTypeCreateFunction( componentID )( newComponents[j], handle,
+						getBufferedComponent( entityCommand.firstComponent + j ) );
+				}
+			} );
+			i += numEntities - 1;
+			break;
+		}
+		case COMMAND_ADD_COMPONENT:
+			ecs.addComponentByType( command.entity, command.componentID, getBufferedComponent( command.firstComponent ) );
+			break;
+		case COMMAND_REMOVE_COMPONENT:
+			ecs.removeComponentByType( command.entity, command.componentID );
+			break;
+		}
+	}
+}
+
+bool ECSCommandBuffer::isSameMake( const Command &command, const Command &other ) const
+{
+	if (other.type != COMMAND_MAKE_ENTITY || other.numComponents != command.numComponents)
+	{
+		return false;
+	}
+	for (uint32 i = 0; i < command.numComponents; i++)
+	{
+		if (components[command.firstComponent + i].componentID != components[other.firstComponent + i].componentID)
+		{
+			return false;
+		}
+	}
+	return true;
+}
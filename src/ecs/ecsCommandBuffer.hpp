@@ -0,0 +1,107 @@
+#pragma once
+//
+// A COMMAND BUFFER records changes to entities (making and removing entities, adding and
+// removing components) so they can be applied later, when nothing is iterating the ECS.
+// Systems can't change entities directly while they are being updated, since moving an entity
+// between archetypes moves other entities' components around underneath the update.
+//
+// Recording is thread safe, so every chunk of a thread safe system can record into the same buffer.
+//
+#include "ecsComponent.hpp"
+#include "dataStructures/array.hpp"
+#include "core/common.hpp"
+#include <mutex>
+
+class ECS;
+
+class ECSCommandBuffer
+{
+public:
+	ECSCommandBuffer() {}
+	~ECSCommandBuffer();
+
+	// the components are copied into the buffer
+	void makeEntity( BaseECSComponent **components, const uint32 *componentIDs, size_t numComponents );
+	template<class... Components>
+	void makeEntity( const Components&... entitycomponents )
+	{
+		BaseECSComponent *comps[] = { (BaseECSComponent*)&entitycomponents... };
+		const uint32 componentIDs[] = { Components::ID... };
+		makeEntity( &comps[0], &componentIDs[0], sizeof...(Components) );
+	}
+
+	void removeEntity( EntityHandle handle );
+
+	void addComponentByType( EntityHandle handle, uint32 componentID, const BaseECSComponent *component );
+	template<class Component>
+	void addComponent( EntityHandle handle, const Component &component )
+	{
+		addComponentByType( handle, Component::ID, &component );
+	}
+
+	void removeComponentByType( EntityHandle handle, uint32 componentID );
+	template<class Component>
+	void removeComponent( EntityHandle handle )
+	{
+		removeComponentByType( handle, Component::ID );
+	}
+
+	bool isEmpty() const { return commands.empty() && removedEntities.empty(); }
+
+	// Apply the recorded changes in the order they were recorded, then clear the buffer.
+	// Removed entities are taken out together at the end, so changes to an entity that was
+	// removed in the same buffer are harmless.
+	// The recorded changes are taken out of the buffer before they are applied, so listeners can
+	// record into it while it is applied.  Those changes are kept for the next apply.
+	void apply( ECS &ecs ) { ECSCommandBuffer *buffer = this; apply( ecs, &buffer, 1 ); }
+
+	// apply several buffers (one after another) with a single batch of removals
+	static void apply( ECS &ecs, ECSCommandBuffer **buffers, size_t numBuffers );
+
+	// throw away the recorded changes
+	void clear();
+
+private:
+	enum CommandType
+	{
+		COMMAND_MAKE_ENTITY,
+		COMMAND_ADD_COMPONENT,
+		COMMAND_REMOVE_COMPONENT
+	};
+
+	struct Command
+	{
+		CommandType type;
+		EntityHandle entity;
+		uint32 firstComponent;	// buffered components of the command
+		uint32 numComponents;
+		uint32 componentID;		// for COMMAND_REMOVE_COMPONENT
+	};
+
+	struct BufferedComponent
+	{
+		uint32 componentID;
+		size_t offset;			// into data
+	};
+
+	Array<Command> commands;
+	Array<BufferedComponent> components;
+	Array<EntityHandle> removedEntities;
+
+	// copies of the recorded components, packed back to back
+	uint8 *data = nullptr;
+	size_t dataSize = 0;
+	size_t dataCapacity = 0;
+	size_t dataAlignment = 0;
+
+	std::mutex mutex;
+
+	void bufferComponent( uint32 componentID, const BaseECSComponent *component );
+	void relocateComponents( uint8 *newData );
+	void swapRecording( ECSCommandBuffer &other );
+	BaseECSComponent *getBufferedComponent( uint32 index ) { return (BaseECSComponent*)(data + components[index].offset); }
+	bool isSameMake( const Command &command, const Command &other ) const;
+	void applyChanges( ECS &ecs, Array<BaseECSComponent*> &componentParam, Array<uint32> &componentIDs );
+
+	NULL_COPY_AND_ASSIGN( ECSCommandBuffer );
+};
@@ -1,20 +1,25 @@
+#include <mutex>
 #include "ecsComponent.hpp"
 
-// class static member decl, will default to null if not initialized
-Array<std::tuple<ECSComponentCreateFunc, ECSComponentFreeFunc, size_t>> *BaseECSComponent::componentTypes = nullptr;
+// class static member decls, zeroed before any static initializer can register a type
+ECSComponentTypeInfo BaseECSComponent::componentTypes[ECS_MAX_COMPONENT_TYPES];
+std::atomic<uint32> BaseECSComponent::numComponentTypes( 0 );
 
-uint32_t BaseECSComponent::registerComponentType( ECSComponentCreateFunc createFn,
-	ECSComponentFreeFunc freeFn, size_t size )
+uint32 BaseECSComponent::registerComponentType( const ECSComponentTypeInfo &typeInfo )
 {
-	if (componentTypes == nullptr)
-	{
-		componentTypes = new Array<std::tuple<ECSComponentCreateFunc, ECSComponentFreeFunc, size_t>>;
-	}
+	// types normally register during static init, but getID can register one from any thread later on
+	static std::mutex registryMutex;
+	std::lock_guard<std::mutex> lock( registryMutex );
 
-	// ID is the array index; we start appending to the end of the current array, so our start index is 
+	// ID is the index in the table; we start appending to the end of the current table, so our start index is
 	// the current size
-	uint32 componentID = componentTypes->size();		
-	componentTypes->push_back( std::tuple<ECSComponentCreateFunc, ECSComponentFreeFunc, size_t>
-		( createFn, freeFn, size /* starting array index */ ) );
-	return componentID++;
-}
\ No newline at end of file
+	uint32 componentID = numComponentTypes.load( std::memory_order_relaxed );
+	if (componentID >= ECS_MAX_COMPONENT_TYPES)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "too many component types, increase ECS_MAX_COMPONENT_TYPES" );
+		return ECS_MAX_COMPONENT_TYPES;		// never valid, so the ECS turns it down
+	}
+	componentTypes[componentID] = typeInfo;
+	numComponentTypes.store( componentID + 1, std::memory_order_release );
+	return componentID;
+}
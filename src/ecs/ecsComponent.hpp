@@ -3,53 +3,198 @@
 // Component base class
 // Components hold data and are operated on by Systems
 //
-#include <tuple>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <atomic>
 #include "core/common.hpp"
 #include "dataStructures/array.hpp"
+#include "ecsSnapshot.hpp"
 
 struct BaseECSComponent;	// fwd decl
-typedef void *EntityHandle;
-typedef Array<uint8> ComponentBlock;
-typedef uint32 ( *ECSComponentCreateFunc)(ComponentBlock &memory, EntityHandle entity,
+
+// An entity handle packs the entity's slot index in the ECS together with the generation of that slot.
+// The generation is bumped every time the slot is freed, so stale handles are easy to spot.
+typedef uint32 EntityHandle;
+#define ECS_ENTITY_INDEX_BITS 22
+#define ECS_ENTITY_INDEX_MASK ((1u << ECS_ENTITY_INDEX_BITS) - 1)
+#define ECS_ENTITY_GENERATION_MASK (0xFFFFFFFFu >> ECS_ENTITY_INDEX_BITS)
+
+typedef void ( *ECSComponentCreateFunc)(void *memory, EntityHandle entity,
 	BaseECSComponent *comp );
 typedef void ( *ECSComponentFreeFunc )(BaseECSComponent *comp);
+// moves the component into memory and destroys what's left of the original
+typedef void ( *ECSComponentRelocateFunc )(void *memory, BaseECSComponent *comp);
 
-#define NULL_ENTITY_HANDLE nullptr
+// snapshot hooks, for component types which can't be saved as raw bytes.
+// deserialize always constructs the component (default constructed if the data is bad)
+struct ECSComponentSerializer
+{
+	void ( *serialize )(const BaseECSComponent *comp, ECSSnapshotWriter &writer);
+	bool ( *deserialize )(void *memory, EntityHandle entity, ECSSnapshotReader &reader);
+};
+
+// what a component type lets us get away with, from its type traits
+enum
+{
+	ECS_COMPONENT_TRIVIALLY_COPYABLE = 1,		// can be moved with memcpy
+	ECS_COMPONENT_TRIVIALLY_DESTRUCTIBLE = 2,	// doesn't need freeing
+	ECS_COMPONENT_TAG = 4						// has no data, entities just have it or not
+};
+
+#define NULL_ENTITY_HANDLE 0xFFFFFFFFu
+
+// component masks have a bit for every component type, so this is the most types that can be registered
+#ifndef ECS_MAX_COMPONENT_TYPES
+#define ECS_MAX_COMPONENT_TYPES 128
+#endif
 
 //
-// Base component struct
-//
+// A set of component types, one bit per component ID.
+// Checking whether one set of types holds all of another is a few ANDs instead of a search.
 //
-struct BaseECSComponent
+class ECSComponentMask
 {
 public:
-	EntityHandle entity = NULL_ENTITY_HANDLE;	// points back to the entity which has this component
-
-	static uint32 registerComponentType(ECSComponentCreateFunc createFn,
-		ECSComponentFreeFunc freeFn, size_t size);			// provides a new ID for each component type 
+	ECSComponentMask() { clear(); }
 
-	static ECSComponentCreateFunc getTypeCreateFunction( uint32 id )
+	void clear()
 	{
-		return std::get<0>( (*componentTypes)[id] );	// returns the appropriate create func (elt 0 in the tuple) 
+		for (uint32 i = 0; i < NUM_WORDS; i++)
+		{
+			words[i] = 0;
+		}
 	}
-	static ECSComponentFreeFunc getTypeFreeFunction( uint32 id )
+	void set( uint32 id ) { words[id / 64] |= (uint64)1 << (id % 64); }
+	void reset( uint32 id ) { words[id / 64] &= ~((uint64)1 << (id % 64)); }
+	bool test( uint32 id ) const { return (words[id / 64] & ((uint64)1 << (id % 64))) != 0; }
+
+	// true if every type in other is in this mask too
+	bool contains( const ECSComponentMask &other ) const
 	{
-		return std::get<1>( (*componentTypes)[id] );
+		for (uint32 i = 0; i < NUM_WORDS; i++)
+		{
+			if ((words[i] & other.words[i]) != other.words[i])
+			{
+				return false;
+			}
+		}
+		return true;
 	}
-	static size_t getTypeSize( uint32 id )
+
+	bool intersects( const ECSComponentMask &other ) const
 	{
-		return std::get<2>( (*componentTypes)[id] );	
+		for (uint32 i = 0; i < NUM_WORDS; i++)
+		{
+			if ((words[i] & other.words[i]) != 0)
+			{
+				return true;
+			}
+		}
+		return false;
 	}
-	static bool isTypeValid( uint32 id )
+
+	bool operator==( const ECSComponentMask &other ) const
 	{
-		return id < componentTypes->size();
+		for (uint32 i = 0; i < NUM_WORDS; i++)
+		{
+			if (words[i] != other.words[i])
+			{
+				return false;
+			}
+		}
+		return true;
 	}
+	bool operator!=( const ECSComponentMask &other ) const { return !(*this == other); }
+
+private:
+	enum { NUM_WORDS = (ECS_MAX_COMPONENT_TYPES + 63) / 64 };
+	uint64 words[NUM_WORDS];
+};
+
+//
+// A field of a component type with a structure of arrays (SoA) layout.
+// Each field gets its own stream in the archetype chunks instead of storing whole components.
+//
+struct ECSComponentField
+{
+	size_t offset;		// offset of the field within the component
+	size_t size;
+	size_t alignment;
+};
+typedef Array<ECSComponentField> ECSComponentFieldList;
+
+//
+// Everything the ECS needs to know about a registered component type.
+// The registry is a fixed array of these: it's plain data, so it's zeroed before any static
+// constructor runs (types can register from anywhere during static init), and looking a type up
+// is a single index instead of going through a pointer to a growable array.
+// Types only ever get added, so once registered a type's entry can be read from any thread, and
+// every ECS in the process shares the one registry
+//
+struct ECSComponentTypeInfo
+{
+	ECSComponentCreateFunc create;
+	ECSComponentFreeFunc free;
+	ECSComponentRelocateFunc relocate;
+	size_t size;
+	size_t alignment;
+	uint32 flags;
+	const ECSComponentFieldList *fields;		// null unless the type has a SoA layout
+	const ECSComponentSerializer *serializer;	// null if the type has no snapshot hooks
+};
+
+//
+// Base component struct
+//
+//
+struct BaseECSComponent
+{
+public:
+	EntityHandle entity = NULL_ENTITY_HANDLE;	// points back to the entity which has this component
+
+	// provides a new ID for each component type
+	static uint32 registerComponentType( const ECSComponentTypeInfo &typeInfo );
+
+	static const ECSComponentTypeInfo &getTypeInfo( uint32 id ) { return componentTypes[id]; }
+	static ECSComponentCreateFunc getTypeCreateFunction( uint32 id ) { return componentTypes[id].create; }
+	static ECSComponentFreeFunc getTypeFreeFunction( uint32 id ) { return componentTypes[id].free; }
+	static ECSComponentRelocateFunc getTypeRelocateFunction( uint32 id ) { return componentTypes[id].relocate; }
+	static size_t getTypeSize( uint32 id ) { return componentTypes[id].size; }
+	static size_t getTypeAlignment( uint32 id ) { return componentTypes[id].alignment; }
+	static uint32 getTypeFlags( uint32 id ) { return componentTypes[id].flags; }
+	// the fields of a type with a SoA layout, null for types stored as whole components
+	static const ECSComponentFieldList *getTypeFields( uint32 id ) { return componentTypes[id].fields; }
+	// the snapshot hooks of the type, null if it doesn't have any
+	static const ECSComponentSerializer *getTypeSerializer( uint32 id ) { return componentTypes[id].serializer; }
+	static bool isTypeValid( uint32 id ) { return id < numComponentTypes.load( std::memory_order_acquire ); }
+	static uint32 getNumTypes() { return numComponentTypes.load( std::memory_order_acquire ); }
+
 private:
-	static Array<std::tuple<ECSComponentCreateFunc, ECSComponentFreeFunc, size_t>> *componentTypes;
+	static ECSComponentTypeInfo componentTypes[ECS_MAX_COMPONENT_TYPES];
+	static std::atomic<uint32> numComponentTypes;	// entries are filled in before they're counted
+};
+
+template<typename T> struct ECSTag;	// fwd decl
+
+// what the registry knows about a type, as compile time constants for code which knows the type
+template<typename ComponentType>
+struct ECSComponentTraits
+{
+	static constexpr bool IS_TAG = std::is_base_of<ECSTag<ComponentType>, ComponentType>::value;
+	static_assert(!IS_TAG || sizeof( ComponentType ) == sizeof( BaseECSComponent ), "tags can't hold any data");
 
+	static constexpr size_t SIZE = sizeof( ComponentType );
+	static constexpr size_t ALIGNMENT = alignof( ComponentType );
+	static constexpr bool IS_TRIVIALLY_COPYABLE = std::is_trivially_copyable<ComponentType>::value;
+	static constexpr bool IS_TRIVIALLY_DESTRUCTIBLE = std::is_trivially_destructible<ComponentType>::value;
+	static constexpr uint32 FLAGS = (IS_TRIVIALLY_COPYABLE ? ECS_COMPONENT_TRIVIALLY_COPYABLE : 0) |
+		(IS_TRIVIALLY_DESTRUCTIBLE ? ECS_COMPONENT_TRIVIALLY_DESTRUCTIBLE : 0) | (IS_TAG ? ECS_COMPONENT_TAG : 0);
+
+	static ECSComponentTypeInfo getTypeInfo();	// the registry entry for the type
 };
 
-// This makes sure that derived components always have the class specific static members they need 
+// This makes sure that derived components always have the class specific static members they need
 // by using the CRTP
 //
 // Curiously Recurring Template Pattern - CRTP consists of:
@@ -62,30 +207,47 @@ struct ECSComponent : public BaseECSComponent
 	static const ECSComponentCreateFunc CREATE_FUNC;
 	static const ECSComponentFreeFunc FREE_FUNC;
 	static const uint32 ID;
-	static const uint32 SIZE;
+	static const size_t SIZE;
+
+	// the same as ID, but registers the type on first use, so it's safe to call from static
+	// initializers which might run before ID is set
+	static uint32 getID()
+	{
+		static const uint32 id = BaseECSComponent::registerComponentType( ECSComponentTraits<T>::getTypeInfo() );
+		return id;
+	}
 };
 
 //
 // Component create function
-// Returns the index of where this component was added into the component list (memory block)
-// The central ECS class has memory blocks (for each component type) that it uses to hold components
+// Constructs a copy of the provided component in the memory given to it.
+// The central ECS class keeps the components in archetype chunks and hands us the slot to fill in
 //
 template<typename ComponentType>
-uint32 ECSComponentCreate( ComponentBlock &memory /* the list of components */,
+void ECSComponentCreate( void *memory /* where the component goes */,
 	EntityHandle entity, BaseECSComponent *componentIn )
 {
-	uint32 index = memory.size();
-	memory.resize( index + ComponentType::SIZE );
-
 	// provide memory for 'new' operation to use
 	// create a new component by copying the provided component
 	ComponentType *convertedComponent = static_cast<ComponentType*>(componentIn);
-	ComponentType *component = new(&memory[index]) ComponentType( *convertedComponent );
+	ComponentType *component = new(memory) ComponentType( *convertedComponent );
 	component->entity = entity;
-	return index;	// returns the starting location (index) in the memory array where the component is
 }
 
-// 
+//
+// component relocate function
+// Components are moved around inside (and between) archetypes as entities come and go.
+// Types which can be memcpy'd never get here, the ECS copies them in bulk instead
+//
+template<typename ComponentType>
+void ECSComponentRelocate( void *memory, BaseECSComponent *comp )
+{
+	ComponentType *component = static_cast<ComponentType*>(comp);
+	new(memory) ComponentType( std::move( *component ) );
+	component->~ComponentType();
+}
+
+//
 // component free fuction
 //
 template<typename ComponentType>
@@ -95,10 +257,158 @@ void ECSComponentFree( BaseECSComponent *comp )
 	component->~ComponentType();	// call DTOR manually
 }
 
+//
+// Component types opt in to a SoA layout by declaring their fields:
+//
+//	static void declareFields( ECSComponentFields<ParticleComponent> &fields )
+//	{
+//		fields.add( &ParticleComponent::position );
+//		fields.add( &ParticleComponent::velocity );
+//	}
+//
+// Every field the component needs has to be declared (not the entity, the archetype already has it).
+// The ECS never holds a whole SoA component, so systems read the field streams with
+// ECSComponentBatch::getField, and ECS::readComponent/writeComponent copy whole components in and out.
+//
+template<typename ComponentType>
+class ECSComponentFields
+{
+public:
+	template<typename FieldType>
+	void add( FieldType ComponentType::*member )
+	{
+		ECSComponentField field;
+		field.offset = getFieldOffset( member );
+		field.size = sizeof( FieldType );
+		field.alignment = alignof( FieldType );
+		fields.push_back( field );
+	}
+
+	template<typename FieldType>
+	static size_t getFieldOffset( FieldType ComponentType::*member )
+	{
+		static const ComponentType instance = ComponentType();
+		return (size_t)((const uint8*)&(instance.*member) - (const uint8*)&instance);
+	}
+
+	const ECSComponentFieldList &getFields() const { return fields; }
+
+private:
+	ECSComponentFieldList fields;
+};
+
+// types without declareFields keep the normal layout
+template<typename ComponentType, typename = void>
+struct ECSComponentLayout
+{
+	enum { IS_SOA = 0 };
+	static const ECSComponentFieldList *getFields() { return nullptr; }
+};
+
+template<typename ComponentType>
+struct ECSComponentLayout<ComponentType,
+	decltype(ComponentType::declareFields( std::declval<ECSComponentFields<ComponentType>&>() ))>
+{
+	// fields are copied around one at a time, so constructors and destructors would never run
+	static_assert(std::is_trivially_copyable<ComponentType>::value &&
+		std::is_trivially_destructible<ComponentType>::value, "SoA components must be trivially copyable");
+
+	enum { IS_SOA = 1 };
+	static const ECSComponentFieldList *getFields()
+	{
+		static const ECSComponentFieldList fields = declareFields();
+		return &fields;
+	}
+
+private:
+	static ECSComponentFieldList declareFields()
+	{
+		ECSComponentFields<ComponentType> fields;
+		ComponentType::declareFields( fields );
+		return fields.getFields();
+	}
+};
+
+//
+// A TAG is a component type with no data ("IsStatic", "IsVisible"), only there to be filtered on:
+//
+//	struct IsStaticTag : public ECSTag<IsStaticTag> {};
+//
+// A tag is laid out as a SoA component with no fields, so it's part of the archetype's set of
+// types (and so of its mask) but takes no room in the chunks.  Check for one with hasComponent,
+// there's nothing to get.
+//
+template<typename T>
+struct ECSTag : public ECSComponent<T>
+{
+	static void declareFields( ECSComponentFields<T> &fields ) {}
+};
+
+// types with serialize and deserialize members get snapshot hooks which call them
+template<typename ComponentType, typename = void>
+struct ECSComponentSerialization
+{
+	static const ECSComponentSerializer *getSerializer() { return nullptr; }
+};
+
+template<typename ComponentType>
+struct ECSComponentSerialization<ComponentType,
+	decltype((void)std::declval<const ComponentType&>().serialize( std::declval<ECSSnapshotWriter&>() ),
+		(void)std::declval<ComponentType&>().deserialize( std::declval<ECSSnapshotReader&>() ))>
+{
+	static const ECSComponentSerializer *getSerializer()
+	{
+		static const ECSComponentSerializer serializer = { serialize, deserialize };
+		return &serializer;
+	}
+
+private:
+	static void serialize( const BaseECSComponent *comp, ECSSnapshotWriter &writer )
+	{
+		static_cast<const ComponentType*>(comp)->serialize( writer );
+	}
+
+	static bool deserialize( void *memory, EntityHandle entity, ECSSnapshotReader &reader )
+	{
+		ComponentType *component = new(memory) ComponentType();
+		component->entity = entity;
+		if (!component->deserialize( reader ))
+		{
+			component->~ComponentType();
+			component = new(memory) ComponentType();
+			component->entity = entity;
+			return false;
+		}
+		return true;
+	}
+};
+
+template<typename ComponentType>
+ECSComponentTypeInfo ECSComponentTraits<ComponentType>::getTypeInfo()
+{
+	ECSComponentTypeInfo typeInfo;
+	typeInfo.create = ECSComponentCreate<ComponentType>;
+	typeInfo.free = ECSComponentFree<ComponentType>;
+	typeInfo.relocate = ECSComponentRelocate<ComponentType>;
+	typeInfo.size = SIZE;
+	typeInfo.alignment = ALIGNMENT;
+	typeInfo.flags = FLAGS;
+	typeInfo.fields = ECSComponentLayout<ComponentType>::getFields();
+	typeInfo.serializer = ECSComponentSerialization<ComponentType>::getSerializer();
+	return typeInfo;
+}
+
+// C++14 still wants the constants defined once outside the class
+template<typename ComponentType> constexpr size_t ECSComponentTraits<ComponentType>::SIZE;
+template<typename ComponentType> constexpr size_t ECSComponentTraits<ComponentType>::ALIGNMENT;
+template<typename ComponentType> constexpr bool ECSComponentTraits<ComponentType>::IS_TRIVIALLY_COPYABLE;
+template<typename ComponentType> constexpr bool ECSComponentTraits<ComponentType>::IS_TRIVIALLY_DESTRUCTIBLE;
+template<typename ComponentType> constexpr uint32 ECSComponentTraits<ComponentType>::FLAGS;
+template<typename ComponentType> constexpr bool ECSComponentTraits<ComponentType>::IS_TAG;
+
 // declare and assign component ID
 template<typename T>
-const uint32 ECSComponent<T>::ID = BaseECSComponent::registerComponentType( ECSComponentCreate<T>,
-	ECSComponentFree<T>, sizeof( T ) );
+const uint32 ECSComponent<T>::ID = ECSComponent<T>::getID();
 
 // declare component SIZE func.
 // returns the size of the component in bytes
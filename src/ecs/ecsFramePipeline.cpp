@@ -0,0 +1,100 @@
+#include "ecsFramePipeline.hpp"
+
+bool ECSFramePipeline::runFrame( const Callback &simulate, const Callback &render, ThreadPool &threadPool )
+{
+	// the sync point
+	ecs.swapBuffers();
+	renderQueries.resize( renderSystems.size() );
+	for (uint32 i = 0; i < renderSystems.size(); i++)
+	{
+		renderQueries[i] = &ecs.query( renderSystems[i]->getComponentTypes(), renderSystems[i]->getComponentFlags() );
+	}
+
+	if (!canOverlap())
+	{
+		if (!isFallbackLogged)
+		{
+			DEBUG_LOG( "ECS", LOG_WARNING, "render systems touch components the simulation writes, so they can't overlap" );
+			isFallbackLogged = true;
+		}
+		render();
+		simulate();
+		return false;
+	}
+
+	// the waiting thread helps with the simulation once the rendering is done
+	ThreadPool::TaskGroup group;
+	threadPool.addTask( simulate, group );
+	render();
+	threadPool.waitForTasks( group );
+	return true;
+}
+
+//
+// The same as ECS::updateSystems, but with the queries from the sync point, and nothing written:
+// no change versions, and no system versions for change filters
+//
+void ECSFramePipeline::updateRenderSystems( float delta )
+{
+	for (uint32 i = 0; i < renderQueries.size(); i++)
+	{
+		if (renderQueries[i]->hasChangeFilter())
+		{
+			if (!isChangeFilterLogged)
+			{
+				DEBUG_LOG( "ECS", LOG_ERROR, "render systems can't have a change filter, %s isn't run",
+					renderSystems[i]->getName() );
+				isChangeFilterLogged = true;
+			}
+			continue;
+		}
+
+		ECS::SystemUpdate update;
+		update.system = renderSystems[i];
+		update.query = renderQueries[i];
+		update.version = 0;
+		update.lastVersion = 0;
+		update.numDependencies = 0;
+		ecs.runSystemChunks( update, delta, false );
+	}
+}
+
+//
+// Every type the simulation systems write has to be read from the previous frame,
+// and the render systems can't write anything
+//
+bool ECSFramePipeline::canOverlap()
+{
+	ECSComponentMask written;
+	for (uint32 i = 0; i < simulationSystems.size(); i++)
+	{
+		const Array<uint32> &types = simulationSystems[i]->getComponentTypes();
+		const Array<uint32> &flags = simulationSystems[i]->getComponentFlags();
+		for (uint32 j = 0; j < types.size(); j++)
+		{
+			if ((flags[j] & BaseECSSystem::FLAG_READ_ONLY) == 0)
+			{
+				written.set( types[j] );
+			}
+		}
+	}
+
+	for (uint32 i = 0; i < renderSystems.size(); i++)
+	{
+		const Array<uint32> &types = renderSystems[i]->getComponentTypes();
+		const Array<uint32> &flags = renderSystems[i]->getComponentFlags();
+		for (uint32 j = 0; j < types.size(); j++)
+		{
+			if ((flags[j] & BaseECSSystem::FLAG_READ_ONLY) == 0)
+			{
+				return false;
+			}
+			bool isPrevious = (flags[j] & BaseECSSystem::FLAG_PREVIOUS_FRAME) && ecs.isDoubleBuffered( types[j] );
+			if (written.test( types[j] ) && !isPrevious)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+//
+// A FRAME PIPELINE renders one frame while the next one is being simulated.  Every frame:
+// - at the sync point, with nothing else running, the double buffered components are copied into
+//   their previous frame copies (ECS::swapBuffers) and the render systems' queries are looked up
+// - the simulation runs as a task on the thread pool (and spreads out from there), writing the new frame
+// - meanwhile the render systems run on the calling thread (the one with the graphics context),
+//   reading the previous frame
+// Rendering shows the world a frame late, and reading or writing a component never takes a lock.
+//
+// The frames only overlap if the render systems just read (FLAG_READ_ONLY), and read every type the
+// simulation systems write from the previous frame (double buffered, with FLAG_PREVIOUS_FRAME).
+// Otherwise the frame runs the rendering and then the simulation, one after the other.
+// Render systems can't have a change filter (FLAG_CHANGED): the change versions are the simulation's,
+// and it's writing them while the rendering runs.  Such a system is logged and not run.
+// The pipeline can't see what the simulation does outside its systems, which has to keep to the
+// same rules: components it writes are double buffered (and marked changed, so swapBuffers copies
+// them), and entities and components are only made or removed at the sync point, so record them
+// in an ECSCommandBuffer while the simulation runs and apply it afterwards.
+//
+#include <functional>
+#include "ecs.hpp"
+#include "core/threadPool.hpp"
+
+class ECSFramePipeline
+{
+public:
+	// simulationSystems are only there to be checked, the simulate callback updates them
+	ECSFramePipeline( ECS &ecsIn, ECSSystemList &simulationSystemsIn, ECSSystemList &renderSystemsIn ) :
+		ecs( ecsIn ), simulationSystems( simulationSystemsIn ), renderSystems( renderSystemsIn ) {}
+
+	typedef std::function<void()> Callback;
+
+	// Goes through the sync point, then runs simulate on the thread pool while render runs on this
+	// thread, and waits for both.  render draws the previous frame with updateRenderSystems.
+	// Returns true if the two ran at the same time
+	bool runFrame( const Callback &simulate, const Callback &render, ThreadPool &threadPool );
+
+	// runs the render systems over the previous frame, from the render callback
+	void updateRenderSystems( float delta );
+
+	// true if the render systems can run while the simulation systems do
+	bool canOverlap();
+
+private:
+	ECS &ecs;
+	ECSSystemList &simulationSystems;
+	ECSSystemList &renderSystems;
+	Array<ECSQuery*> renderQueries;		// looked up at the sync point, the simulation may be making queries later
+	bool isFallbackLogged = false;
+	bool isChangeFilterLogged = false;
+
+	NULL_COPY_AND_ASSIGN( ECSFramePipeline );
+};
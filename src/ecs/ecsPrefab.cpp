@@ -0,0 +1,82 @@
+#include <algorithm>
+#include "ecsPrefab.hpp"
+
+void ECSPrefab::init( BaseECSComponent **components, const uint32 *ids, size_t numComponents )
+{
+	// the components go in column order, so sort them by ID
+	Array<uint32> order( numComponents );
+	for (uint32 i = 0; i < numComponents; i++)
+	{
+		if (!BaseECSComponent::isTypeValid( ids[i] ))
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "%u is not a valid component type", ids[i] );
+			valid = false;
+			return;
+		}
+		order[i] = i;
+	}
+	std::sort( order.begin(), order.end(), [ids]( uint32 a, uint32 b ) { return ids[a] < ids[b]; } );
+	for (uint32 i = 1; i < numComponents; i++)
+	{
+		if (ids[order[i]] == ids[order[i - 1]])
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "prefab has more than one component of type %u", ids[order[i]] );
+			valid = false;
+			return;
+		}
+	}
+
+	size_t size = 0;
+	size_t alignment = Memory::DEFAULT_ALIGNMENT;
+	componentIDs.resize( numComponents );
+	componentOffsets.resize( numComponents );
+	for (uint32 i = 0; i < numComponents; i++)
+	{
+		componentIDs[i] = ids[order[i]];
+		size_t componentAlignment = BaseECSComponent::getTypeAlignment( componentIDs[i] );
+		alignment = std::max( alignment, componentAlignment );
+		componentOffsets[i] = size = Memory::align( size, componentAlignment );
+		size += BaseECSComponent::getTypeSize( componentIDs[i] );
+	}
+
+	memory = (uint8*)Memory::malloc( std::max( size, (size_t)1 ), (uint32)alignment );
+	for (uint32 i = 0; i < numComponents; i++)
+	{
+		BaseECSComponent::getTypeCreateFunction( componentIDs[i] )( memory + componentOffsets[i],
+			NULL_ENTITY_HANDLE, components[order[i]] );
+	}
+}
+
+ECSPrefab::~ECSPrefab()
+{
+	if (memory == nullptr)
+	{
+		return;
+	}
+	for (uint32 i = 0; i < componentIDs.size(); i++)
+	{
+		BaseECSComponent::getTypeFreeFunction( componentIDs[i] )( (BaseECSComponent*)(memory + componentOffsets[i]) );
+	}
+	Memory::free( memory );
+}
+
+int32 ECSPrefab::getColumnIndex( uint32 componentID ) const
+{
+	Array<uint32>::const_iterator it = std::lower_bound( componentIDs.begin(), componentIDs.end(), componentID );
+	return it != componentIDs.end() && *it == componentID ? (int32)(it - componentIDs.begin()) : -1;
+}
+
+bool ECSPrefab::setComponentByType( uint32 componentID, const BaseECSComponent *component )
+{
+	int32 column = getColumnIndex( componentID );
+	if (column < 0)
+	{
+		return false;
+	}
+
+	BaseECSComponent *prefabComponent = (BaseECSComponent*)(memory + componentOffsets[column]);
+	BaseECSComponent::getTypeFreeFunction( componentID )( prefabComponent );
+	BaseECSComponent::getTypeCreateFunction( componentID )( prefabComponent, NULL_ENTITY_HANDLE,
+		(BaseECSComponent*)component );
+	return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+//
+// A PREFAB is a set of components laid out once, ready to be stamped out as any number of entities
+// with ECS::instantiate.  The components are kept in the order of their archetype's columns, so
+// instantiating copies each of them straight into a run of rows (a few doubling memcpys for types
+// which can be memcpy'd) instead of going through the component list again for every entity.
+//
+#include "ecsComponent.hpp"
+#include "core/memory.hpp"
+
+class ECSPrefab
+{
+public:
+	ECSPrefab( BaseECSComponent **components, const uint32 *componentIDs, size_t numComponents )
+	{
+		init( components, componentIDs, numComponents );
+	}
+
+	// only takes part in overload resolution for components, so it doesn't hide the raw version above
+	template<class Component, class... Components, typename std::enable_if<
+		std::is_base_of<BaseECSComponent, Component>::value, int>::type = 0>
+	explicit ECSPrefab( const Component &component, const Components&... components )
+	{
+		BaseECSComponent *comps[] = { (BaseECSComponent*)&component, (BaseECSComponent*)&components... };
+		const uint32 ids[] = { Component::ID, Components::ID... };
+		init( &comps[0], &ids[0], 1 + sizeof...(Components) );
+	}
+	~ECSPrefab();
+
+	// false if the component list had bad or repeated types
+	bool isValid() const { return valid; }
+
+	// sorted, one per archetype column
+	const Array<uint32> &getComponentIDs() const { return componentIDs; }
+	int32 getColumnIndex( uint32 componentID ) const;
+
+	// the prefab's copy of the component in each column, SoA components included
+	const BaseECSComponent *getComponent( uint32 column ) const
+	{
+		return (const BaseECSComponent*)(memory + componentOffsets[column]);
+	}
+
+	// changes what later instances get, entities already made from the prefab keep their copy
+	template<class Component>
+	bool setComponent( const Component &component )
+	{
+		return setComponentByType( Component::ID, (const BaseECSComponent*)&component );
+	}
+	bool setComponentByType( uint32 componentID, const BaseECSComponent *component );
+
+private:
+	Array<uint32> componentIDs;
+	Array<size_t> componentOffsets;
+	uint8 *memory = nullptr;
+	bool valid = true;
+
+	void init( BaseECSComponent **components, const uint32 *ids, size_t numComponents );
+
+	NULL_COPY_AND_ASSIGN( ECSPrefab );
+};
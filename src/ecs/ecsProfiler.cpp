@@ -0,0 +1,189 @@
+// rapidjson goes first: its Writer::String clashes with the String macro in dataStructures/string.hpp
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> ECSProfileWriter;
+
+static void writeString( ECSProfileWriter &writer, const char *str )
+{
+	writer.String( str );
+}
+
+#include "ecsProfiler.hpp"
+#include "core/timing.hpp"
+
+static_assert((ECS_PROFILER_CAPACITY & (ECS_PROFILER_CAPACITY - 1)) == 0, "ECS_PROFILER_CAPACITY must be a power of 2");
+
+//
+// threads get a small index the first time they record a sample, so traces have readable thread IDs
+//
+static uint32 getThreadIndex()
+{
+	static std::atomic<uint32> numThreads( 0 );
+	static thread_local uint32 threadIndex = numThreads++;
+	return threadIndex;
+}
+
+double ECSProfiler::beginSample() const
+{
+	return enabled ? Time::getTime() : 0.0;
+}
+
+void ECSProfiler::endSample( BaseECSSystem &system, const ECSQuery &systemQuery, double startTime,
+	const ECSProfileCounts &counts )
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	ECSProfileSample sample;
+	sample.duration = Time::getTime() - startTime;
+	sample.systemName = system.getName();
+	sample.frame = frame;
+	sample.thread = getThreadIndex();
+	sample.startTime = startTime;
+	sample.numArchetypes = (uint32)systemQuery.getNumArchetypes();
+	sample.numChunks = counts.numChunks.load( std::memory_order_relaxed );
+	sample.numEntities = counts.numEntities.load( std::memory_order_relaxed );
+	sample.numBytes = counts.numBytes.load( std::memory_order_relaxed );
+
+	// claim a slot, other threads writing at the same time get the slots after it
+	uint64 slot = numSamplesWritten.fetch_add( 1, std::memory_order_relaxed );
+	samples[slot & (ECS_PROFILER_CAPACITY - 1)] = sample;
+}
+
+//
+// Every entity of a matching archetype is handed the components in the archetype's columns
+//
+size_t ECSProfiler::getRowSize( const ECSQuery &systemQuery, uint32 archetypeIndex )
+{
+	const Array<uint32> &componentTypes = systemQuery.getComponentTypes();
+	ECSArchetype &archetype = systemQuery.getArchetype( archetypeIndex );
+	const int32 *columns = systemQuery.getColumns( archetypeIndex );
+	size_t rowSize = 0;
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		if (columns[i] < 0)
+		{
+			continue;
+		}
+		const ECSComponentFieldList *fields = archetype.getColumnFields( columns[i] );
+		for (uint32 j = 0; fields != nullptr && j < fields->size(); j++)
+		{
+			rowSize += (*fields)[j].size;
+		}
+		rowSize += fields == nullptr ? archetype.getColumnStride( columns[i] ) : 0;
+	}
+	return rowSize;
+}
+
+uint64 ECSProfiler::getSamples( Array<ECSProfileSample> &output ) const
+{
+	uint64 numWritten = numSamplesWritten.load( std::memory_order_acquire );
+	uint64 numLost = numWritten > ECS_PROFILER_CAPACITY ? numWritten - ECS_PROFILER_CAPACITY : 0;
+	output.clear();
+	output.reserve( (size_t)(numWritten - numLost) );
+	for (uint64 i = numLost; i < numWritten; i++)
+	{
+		output.push_back( samples[i & (ECS_PROFILER_CAPACITY - 1)] );
+	}
+	return numLost;
+}
+
+void ECSProfiler::writeJSON( String &output ) const
+{
+	Array<ECSProfileSample> recorded;
+	uint64 numLost = getSamples( recorded );
+
+	rapidjson::StringBuffer buffer;
+	ECSProfileWriter writer( buffer );
+	writer.StartObject();
+	writer.Key( "lostSamples" );
+	writer.Uint64( numLost );
+	writer.Key( "samples" );
+	writer.StartArray();
+	for (uint32 i = 0; i < recorded.size(); i++)
+	{
+		const ECSProfileSample &sample = recorded[i];
+		writer.StartObject();
+		writer.Key( "system" );
+		writeString( writer, sample.systemName );
+		writer.Key( "frame" );
+		writer.Uint64( sample.frame );
+		writer.Key( "thread" );
+		writer.Uint( sample.thread );
+		writer.Key( "start" );
+		writer.Double( sample.startTime );
+		writer.Key( "duration" );
+		writer.Double( sample.duration );
+		writer.Key( "archetypes" );
+		writer.Uint( sample.numArchetypes );
+		writer.Key( "chunks" );
+		writer.Uint( sample.numChunks );
+		writer.Key( "entities" );
+		writer.Uint( sample.numEntities );
+		writer.Key( "bytes" );
+		writer.Uint64( sample.numBytes );
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+	output.assign( buffer.GetString(), buffer.GetSize() );
+}
+
+//
+// Each sample becomes a complete ("X") event, with times in microseconds from the first sample
+//
+void ECSProfiler::writeChromeTrace( String &output ) const
+{
+	Array<ECSProfileSample> recorded;
+	getSamples( recorded );
+	double firstTime = recorded.empty() ? 0.0 : recorded[0].startTime;
+	for (uint32 i = 0; i < recorded.size(); i++)
+	{
+		firstTime = recorded[i].startTime < firstTime ? recorded[i].startTime : firstTime;
+	}
+
+	rapidjson::StringBuffer buffer;
+	ECSProfileWriter writer( buffer );
+	writer.StartObject();
+	writer.Key( "displayTimeUnit" );
+	writeString( writer, "ms" );
+	writer.Key( "traceEvents" );
+	writer.StartArray();
+	for (uint32 i = 0; i < recorded.size(); i++)
+	{
+		const ECSProfileSample &sample = recorded[i];
+		writer.StartObject();
+		writer.Key( "name" );
+		writeString( writer, sample.systemName );
+		writer.Key( "cat" );
+		writeString( writer, "ecs" );
+		writer.Key( "ph" );
+		writeString( writer, "X" );
+		writer.Key( "ts" );
+		writer.Double( (sample.startTime - firstTime) * 1000000.0 );
+		writer.Key( "dur" );
+		writer.Double( sample.duration * 1000000.0 );
+		writer.Key( "pid" );
+		writer.Uint( 0 );
+		writer.Key( "tid" );
+		writer.Uint( sample.thread );
+		writer.Key( "args" );
+		writer.StartObject();
+		writer.Key( "frame" );
+		writer.Uint64( sample.frame );
+		writer.Key( "chunks" );
+		writer.Uint( sample.numChunks );
+		writer.Key( "entities" );
+		writer.Uint( sample.numEntities );
+		writer.Key( "bytes" );
+		writer.Uint64( sample.numBytes );
+		writer.EndObject();
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+	output.assign( buffer.GetString(), buffer.GetSize() );
+}
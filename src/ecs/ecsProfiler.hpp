@@ -0,0 +1,91 @@
+#pragma once
+//
+// The PROFILER records how long each system took to update, and how much it touched.
+// Compiled in with ECS_PROFILING (the CMake option of the same name).  Without it the ECS has
+// no profiler and updating systems doesn't pay for it at all.
+//
+// Samples go in a fixed size ring buffer which update tasks on any thread write to without
+// taking a lock, so the newest ECS_PROFILER_CAPACITY samples are always kept.  Read the samples
+// (or export them) between updates, not while systems are running.
+//
+#include "ecsSystem.hpp"
+#include "ecsQuery.hpp"
+#include "dataStructures/array.hpp"
+#include "dataStructures/string.hpp"
+#include "core/common.hpp"
+#include <atomic>
+
+#define ECS_PROFILER_CAPACITY 4096	// must be a power of 2
+
+// one update of one system
+struct ECSProfileSample
+{
+	const char *systemName;
+	uint64 frame;
+	uint32 thread;			// small index for the thread which ran the update
+	double startTime;		// seconds
+	double duration;
+	uint32 numArchetypes;	// archetypes matched by the system
+	uint32 numChunks;		// chunks the system was run over
+	uint32 numEntities;		// entities the system was run over
+	uint64 numBytes;		// bytes of component data the system was given
+};
+
+// What a system update was run over, added up by the update as it goes.
+// Atomic so the per-chunk tasks of a thread safe system can add to the same counts
+struct ECSProfileCounts
+{
+	std::atomic<uint32> numChunks;
+	std::atomic<uint32> numEntities;
+	std::atomic<uint64> numBytes;
+
+	ECSProfileCounts() : numChunks( 0 ), numEntities( 0 ), numBytes( 0 ) {}
+
+	// rowSize from ECSProfiler::getRowSize
+	void addChunk( const ECSChunk &chunk, size_t rowSize )
+	{
+		numChunks.fetch_add( 1, std::memory_order_relaxed );
+		numEntities.fetch_add( chunk.numEntities, std::memory_order_relaxed );
+		numBytes.fetch_add( (uint64)rowSize * chunk.numEntities, std::memory_order_relaxed );
+	}
+};
+
+class ECSProfiler
+{
+public:
+	ECSProfiler() : samples( ECS_PROFILER_CAPACITY ), numSamplesWritten( 0 ), frame( 0 ), enabled( true ) {}
+
+	// disabled profilers don't record anything
+	void setEnabled( bool enabledIn ) { enabled = enabledIn; }
+	bool isEnabled() const { return enabled; }
+
+	// samples are tagged with the frame they were recorded in, call once per frame
+	void nextFrame() { frame++; }
+	uint64 getFrame() const { return frame; }
+
+	// call around a system update: beginSample returns the start time to hand to endSample,
+	// along with the counts of the chunks the update visited (chunks skipped by a change filter
+	// aren't counted).  Safe to call from any thread
+	double beginSample() const;
+	void endSample( BaseECSSystem &system, const ECSQuery &systemQuery, double startTime, const ECSProfileCounts &counts );
+
+	// bytes of component data each entity of the query's archetype hands the system
+	static size_t getRowSize( const ECSQuery &systemQuery, uint32 archetypeIndex );
+
+	// copies out the recorded samples, oldest first.  Returns the number of samples
+	// which were overwritten before they could be read
+	uint64 getSamples( Array<ECSProfileSample> &output ) const;
+	void clear() { numSamplesWritten = 0; }
+
+	// export the samples as a JSON list, or in the Chrome trace event format (for chrome://tracing)
+	void writeJSON( String &output ) const;
+	void writeChromeTrace( String &output ) const;
+
+private:
+	Array<ECSProfileSample> samples;
+	std::atomic<uint64> numSamplesWritten;	// the next sample goes in slot numSamplesWritten % capacity
+	uint64 frame;
+	bool enabled;
+
+	NULL_COPY_AND_ASSIGN( ECSProfiler );
+};
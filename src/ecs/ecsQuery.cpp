@@ -0,0 +1,115 @@
+#include "ecsQuery.hpp"
+
+ECSQuery::ECSQuery( const Array<uint32> &componentTypesIn, const Array<uint32> &componentFlagsIn ) :
+	componentTypes( componentTypesIn ), componentFlags( componentFlagsIn )
+{
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		accessMask.set( componentTypes[i] );
+		changeFilter = changeFilter || (componentFlags[i] & BaseECSSystem::FLAG_CHANGED) != 0;
+		if ((componentFlags[i] & BaseECSSystem::FLAG_OPTIONAL) == 0)
+		{
+			requiredMask.set( componentTypes[i] );
+		}
+	}
+}
+
+uint32 ECSQuery::getNumEntities() const
+{
+	uint32 numEntities = 0;
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{
+		numEntities += archetypes[i]->getNumEntities();
+	}
+
+	return numEntities;
+}
+
+//
+// Match the archetype with a mask test, then find the archetype column of each component type.
+// Missing optional types get a column of -1
+//
+bool ECSQuery::addArchetype( ECSArchetype &archetype )
+{
+	if (!archetype.getMask().contains( requiredMask ))
+	{
+		return false;
+	}
+
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		columns.push_back( archetype.getColumnIndex( componentTypes[i] ) );
+	}
+	archetypes.push_back( &archetype );
+	return true;
+}
+
+bool ECSQuery::hasChanged( size_t archetypeIndex, ECSChunk &chunk, uint32 sinceVersion ) const
+{
+	ECSArchetype &archetype = *archetypes[archetypeIndex];
+	const int32 *archetypeColumns = getColumns( archetypeIndex );
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		if (archetypeColumns[i] >= 0 && (!changeFilter || (componentFlags[i] & BaseECSSystem::FLAG_CHANGED)) &&
+			archetype.getColumnVersion( chunk, archetypeColumns[i] ) > sinceVersion)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ECSQuery::markWritten( size_t archetypeIndex, ECSChunk &chunk, uint32 version ) const
+{
+	uint32 *versions = archetypes[archetypeIndex]->getColumnVersions( chunk );
+	const int32 *archetypeColumns = getColumns( archetypeIndex );
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		if (archetypeColumns[i] >= 0 && (componentFlags[i] & BaseECSSystem::FLAG_READ_ONLY) == 0)
+		{
+			versions[archetypeColumns[i]] = version;
+		}
+	}
+}
+
+void ECSQuery::getBatch( size_t archetypeIndex, ECSChunk &chunk, ECSComponentBatch &batch ) const
+{
+	ECSArchetype &archetype = *archetypes[archetypeIndex];
+	const int32 *archetypeColumns = getColumns( archetypeIndex );
+	uint32 numColumns = (uint32)componentTypes.size();
+
+	batch.columns.resize( numColumns );
+	batch.strides.resize( numColumns );
+	batch.fields.resize( numColumns );
+	batch.firstStream.resize( numColumns );
+	batch.fieldStreams.clear();
+	batch.componentParam.resize( numColumns );
+	batch.entities = archetype.getEntities( chunk );
+	batch.count = chunk.numEntities;
+	for (uint32 i = 0; i < numColumns; i++)
+	{
+		int32 column = archetypeColumns[i];
+		batch.fields[i] = nullptr;
+		batch.columns[i] = nullptr;
+		batch.strides[i] = 0;
+		if (column < 0)
+		{
+			continue;
+		}
+
+		if (archetype.isSoAColumn( column ))
+		{
+			const ECSComponentFieldList *fields = archetype.getColumnFields( column );
+			batch.fields[i] = fields;
+			batch.firstStream[i] = (uint32)batch.fieldStreams.size();
+			for (uint32 j = 0; j < fields->size(); j++)
+			{
+				batch.fieldStreams.push_back( archetype.getFieldStream( chunk, column, j ) );
+			}
+			continue;
+		}
+		bool isPrevious = (componentFlags[i] & BaseECSSystem::FLAG_PREVIOUS_FRAME) && archetype.isDoubleBuffered( column );
+		batch.columns[i] = isPrevious ? archetype.getPreviousColumn( chunk, column ) : archetype.getColumn( chunk, column );
+		batch.strides[i] = archetype.getColumnStride( column );
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+//
+// A QUERY is a cached list of the archetypes which have a set of component types.
+// The ECS keeps every query up to date as archetypes are created, and an archetype's
+// component types never change, so entities joining or leaving an archetype don't
+// touch the query at all.  Iterating a query only visits matching entities.
+//
+#include "ecsArchetype.hpp"
+#include "ecsSystem.hpp"
+#include "dataStructures/array.hpp"
+#include "core/common.hpp"
+
+class ECSQuery
+{
+public:
+	// componentFlags uses the BaseECSSystem flags, a type with FLAG_OPTIONAL doesn't have to be there
+	ECSQuery( const Array<uint32> &componentTypesIn, const Array<uint32> &componentFlagsIn );
+
+	const Array<uint32> &getComponentTypes() const { return componentTypes; }
+	const Array<uint32> &getComponentFlags() const { return componentFlags; }
+	const ECSComponentMask &getRequiredMask() const { return requiredMask; }
+	const ECSComponentMask &getAccessMask() const { return accessMask; }	// every type, optional or not
+
+	// matching archetypes, which may currently be empty
+	size_t getNumArchetypes() const { return archetypes.size(); }
+	ECSArchetype &getArchetype( size_t index ) const { return *archetypes[index]; }
+
+	// the archetype column of each component type (-1 if missing and optional)
+	const int32 *getColumns( size_t index ) const { return &columns[index * componentTypes.size()]; }
+
+	uint32 getNumEntities() const;
+
+	// true if the query has component types with FLAG_CHANGED
+	bool hasChangeFilter() const { return changeFilter; }
+
+	// true if the chunk's FLAG_CHANGED columns (or every column, without a change filter) were
+	// written after sinceVersion
+	bool hasChanged( size_t archetypeIndex, ECSChunk &chunk, uint32 sinceVersion ) const;
+
+	// stamps the columns the query can write to (the ones without FLAG_READ_ONLY) with the version
+	void markWritten( size_t archetypeIndex, ECSChunk &chunk, uint32 version ) const;
+
+	// adds the archetype if it has all of the (non-optional) component types.
+	// Returns true if it matched
+	bool addArchetype( ECSArchetype &archetype );
+
+	// sets up the batch to hold one chunk of a matching archetype
+	void getBatch( size_t archetypeIndex, ECSChunk &chunk, ECSComponentBatch &batch ) const;
+
+	// calls func( const ECSComponentBatch& ) for each chunk of matching entities,
+	// with the component types in the order they were given to the query
+	template<typename Func>
+	void forEachBatch( Func func )
+	{
+		for (uint32 i = 0; i < archetypes.size(); i++)
+		{
+			for (uint32 j = 0; j < archetypes[i]->getNumChunks(); j++)
+			{
+				getBatch( i, archetypes[i]->getChunk( j ), batch );
+				func( (const ECSComponentBatch&)batch );
+			}
+		}
+	}
+
+	// forEachBatch for just the chunks which changed after sinceVersion (see ECS::getChangeVersion)
+	template<typename Func>
+	void forEachChangedBatch( uint32 sinceVersion, Func func )
+	{
+		for (uint32 i = 0; i < archetypes.size(); i++)
+		{
+			for (uint32 j = 0; j < archetypes[i]->getNumChunks(); j++)
+			{
+				if (hasChanged( i, archetypes[i]->getChunk( j ), sinceVersion ))
+				{
+					getBatch( i, archetypes[i]->getChunk( j ), batch );
+					func( (const ECSComponentBatch&)batch );
+				}
+			}
+		}
+	}
+
+private:
+	Array<uint32> componentTypes;
+	Array<uint32> componentFlags;
+	ECSComponentMask requiredMask;
+	ECSComponentMask accessMask;
+	bool changeFilter = false;
+	Array<ECSArchetype*> archetypes;
+	Array<int32> columns;			// columns of the component types, for each archetype in turn
+	ECSComponentBatch batch;		// reused by forEachBatch
+
+	NULL_COPY_AND_ASSIGN( ECSQuery );
+};
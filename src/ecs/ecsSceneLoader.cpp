@@ -0,0 +1,723 @@
+// rapidjson goes first: the SAX handler needs a String method, which clashes with the String macro
+// in dataStructures/string.hpp
+#include <cstdio>
+#include <cstring>
+#include "rapidjson/reader.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/memorystream.h"
+#include "rapidjson/error/en.h"
+
+//
+// Passes the SAX events on to the scene parser.  Booleans are numbers as far as fields are concerned
+//
+template<class Parser>
+class ECSSceneHandler
+{
+public:
+	explicit ECSSceneHandler( Parser &parserIn ) : parser( parserIn ) {}
+
+	bool Null() { return parser.fail( "fields can't be null" ); }
+	bool Bool( bool value ) { return parser.number( value ? 1.0 : 0.0 ); }
+	bool Int( int value ) { return parser.number( (double)value ); }
+	bool Uint( unsigned value ) { return parser.number( (double)value ); }
+	bool Int64( int64_t value ) { return parser.number( (double)value ); }
+	bool Uint64( uint64_t value ) { return parser.number( (double)value ); }
+	bool Double( double value ) { return parser.number( value ); }
+	bool RawNumber( const char*, rapidjson::SizeType, bool ) { return parser.fail( "unexpected raw number" ); }
+	bool String( const char *str, rapidjson::SizeType length, bool ) { return parser.string( str, length ); }
+	bool StartObject() { return parser.startObject(); }
+	bool Key( const char *str, rapidjson::SizeType length, bool ) { return parser.key( str, length ); }
+	bool EndObject( rapidjson::SizeType ) { return parser.endObject(); }
+	bool StartArray() { return parser.startArray(); }
+	bool EndArray( rapidjson::SizeType ) { return parser.endArray(); }
+
+private:
+	Parser &parser;
+};
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "ecsSceneLoader.hpp"
+
+#define ECS_SCENE_BATCHES_IN_FLIGHT 4	// batches the parsing thread can get ahead of the loading thread
+
+const BaseECSSceneComponentType::Field *BaseECSSceneComponentType::findField( const char *fieldName, size_t length ) const
+{
+	for (uint32 i = 0; i < fields.size(); i++)
+	{
+		if (fields[i].name.size() == length && Memory::memcmp( fields[i].name.data(), fieldName, length ) == 0)
+		{
+			return &fields[i];
+		}
+	}
+	return nullptr;
+}
+
+void BaseECSSceneComponentType::addNumberField( const String &fieldName, uint32 numNumbers, const NumberSetter &setter )
+{
+	if (numNumbers == 0 || numNumbers > ECS_SCENE_MAX_FIELD_NUMBERS)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "scene field %s.%s can't take %u numbers", name.c_str(), fieldName.c_str(), numNumbers );
+		return;
+	}
+
+	Field field;
+	field.name = fieldName;
+	field.numNumbers = numNumbers;
+	field.setNumbers = setter;
+	fields.push_back( field );
+}
+
+void BaseECSSceneComponentType::addStringField( const String &fieldName, const StringSetter &setter )
+{
+	Field field;
+	field.name = fieldName;
+	field.numNumbers = 0;
+	field.setString = setter;
+	fields.push_back( field );
+}
+
+ECSSceneLoader::~ECSSceneLoader()
+{
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		delete componentTypes[i];
+	}
+}
+
+void ECSSceneLoader::addComponentType( BaseECSSceneComponentType *type )
+{
+	if (findComponentType( type->getName().data(), type->getName().size() ) != nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_WARNING, "scene component type %s is registered twice, the first one is used",
+			type->getName().c_str() );
+	}
+	componentTypes.push_back( type );
+}
+
+BaseECSSceneComponentType *ECSSceneLoader::findComponentType( const char *name, size_t length ) const
+{
+	for (uint32 i = 0; i < componentTypes.size(); i++)
+	{
+		const String &typeName = componentTypes[i]->getName();
+		if (typeName.size() == length && Memory::memcmp( typeName.data(), name, length ) == 0)
+		{
+			return componentTypes[i];
+		}
+	}
+	return nullptr;
+}
+
+//
+// Entities waiting to go into the ECS, all with the same component types.
+// Each type has room for ECS_SCENE_BATCH_SIZE components, allocated when the types are set so
+// staged components never move
+//
+class ECSSceneBatch
+{
+public:
+	ECSSceneBatch() {}
+	~ECSSceneBatch() { release( 0 ); }
+
+	uint32 getNumEntities() const { return numEntities; }
+	bool isFull() const { return numEntities == ECS_SCENE_BATCH_SIZE; }
+	const Array<BaseECSSceneComponentType*> &getTypes() const { return types; }
+
+	// only while the batch is empty
+	void setTypes( const Array<BaseECSSceneComponentType*> &typesIn )
+	{
+		assertCheck( numEntities == 0 );
+		types = typesIn;
+		memory.resize( types.size() );
+		components.resize( types.size() );
+		strides.resize( types.size() );
+		for (uint32 i = 0; i < types.size(); i++)
+		{
+			uint32 componentID = types[i]->getComponentID();
+			size_t alignment = BaseECSComponent::getTypeAlignment( componentID );
+			strides[i] = Memory::align( BaseECSComponent::getTypeSize( componentID ), alignment );
+			memory[i].resize( strides[i] * ECS_SCENE_BATCH_SIZE + alignment );
+			components[i] = Memory::align( memory[i].data(), alignment );
+		}
+	}
+
+	// returns the index of each of the types in the batch, or false if the batch has different types
+	bool matchTypes( const Array<BaseECSSceneComponentType*> &otherTypes, Array<uint32> &indices ) const
+	{
+		if (otherTypes.size() != types.size())
+		{
+			return false;
+		}
+		indices.resize( otherTypes.size() );
+		for (uint32 i = 0; i < otherTypes.size(); i++)
+		{
+			uint32 j = 0;
+			while (j < types.size() && types[j] != otherTypes[i])
+			{
+				j++;
+			}
+			if (j == types.size())
+			{
+				return false;
+			}
+			indices[i] = j;
+		}
+		return true;
+	}
+
+	// the next entity goes at the end, the caller fills in its components
+	uint32 addEntity() { return numEntities++; }
+
+	BaseECSComponent *getComponent( uint32 typeIndex, uint32 entity )
+	{
+		return (BaseECSComponent*)(components[typeIndex] + entity * strides[typeIndex]);
+	}
+
+	// frees the components of the entities from firstEntity on, and empties the batch
+	void release( uint32 firstEntity )
+	{
+		for (uint32 i = 0; i < types.size(); i++)
+		{
+			ECSComponentFreeFunc freefn = BaseECSComponent::getTypeFreeFunction( types[i]->getComponentID() );
+			for (uint32 j = firstEntity; j < numEntities; j++)
+			{
+				freefn( getComponent( i, j ) );
+			}
+		}
+		numEntities = 0;
+	}
+
+private:
+	Array<BaseECSSceneComponentType*> types;
+	Array<Array<uint8>> memory;
+	Array<uint8*> components;		// the aligned start of the components of each type
+	Array<size_t> strides;
+	uint32 numEntities = 0;
+
+	NULL_COPY_AND_ASSIGN( ECSSceneBatch );
+};
+
+//
+// Builds entities from the SAX events of a scene, and hands over each batch once it's full
+// (or the next entity has different component types).
+// submitBatch returns the batch to fill in next, or null to stop parsing
+//
+class ECSSceneParser
+{
+public:
+	typedef std::function<ECSSceneBatch*( ECSSceneBatch *batch )> BatchSubmitter;
+
+	ECSSceneParser( const ECSSceneLoader &loaderIn, ECSSceneBatch *firstBatch, const BatchSubmitter &submitBatchIn ) :
+		loader( loaderIn ), batch( firstBatch ), submitBatch( submitBatchIn ) {}
+	~ECSSceneParser() { freeEntity(); }
+
+	const String &getError() const { return error; }
+	bool wasStopped() const { return stopped; }
+
+	bool fail( const char *message )
+	{
+		error = message;
+		return false;
+	}
+
+	bool startObject()
+	{
+		switch (state)
+		{
+		case STATE_EXPECT_SCENE:
+			state = STATE_SCENE;
+			return true;
+		case STATE_ENTITIES:
+			state = STATE_ENTITY;
+			return true;
+		case STATE_EXPECT_COMPONENT:
+			state = STATE_COMPONENT;
+			return true;
+		default:
+			return fail( "unexpected object" );
+		}
+	}
+
+	bool key( const char *str, size_t length )
+	{
+		switch (state)
+		{
+		case STATE_SCENE:
+			if (length != 8 || Memory::memcmp( str, "entities", 8 ) != 0)
+			{
+				return fail( ("unknown scene key " + String( str, length )).c_str() );
+			}
+			state = STATE_EXPECT_ENTITIES;
+			return true;
+		case STATE_ENTITY:
+			state = STATE_EXPECT_COMPONENT;
+			return addComponent( str, length );
+		case STATE_COMPONENT:
+			field = entityTypes.back()->findField( str, length );
+			if (field == nullptr)
+			{
+				return fail( ("unknown field " + entityTypes.back()->getName() + "." + String( str, length )).c_str() );
+			}
+			state = STATE_EXPECT_FIELD_VALUE;
+			return true;
+		default:
+			return fail( "unexpected key" );
+		}
+	}
+
+	bool endObject()
+	{
+		switch (state)
+		{
+		case STATE_COMPONENT:
+			state = STATE_ENTITY;
+			return true;
+		case STATE_ENTITY:
+			state = STATE_ENTITIES;
+			return addEntity();
+		case STATE_SCENE:
+			state = STATE_DONE;
+			return batch->getNumEntities() == 0 || submit();
+		default:
+			return fail( "unexpected end of object" );
+		}
+	}
+
+	bool startArray()
+	{
+		switch (state)
+		{
+		case STATE_EXPECT_ENTITIES:
+			state = STATE_ENTITIES;
+			return true;
+		case STATE_EXPECT_FIELD_VALUE:
+			if (field->numNumbers == 0)
+			{
+				return fail( ("field " + field->name + " needs a string").c_str() );
+			}
+			numNumbers = 0;
+			state = STATE_FIELD_ARRAY;
+			return true;
+		default:
+			return fail( "unexpected array" );
+		}
+	}
+
+	bool endArray()
+	{
+		switch (state)
+		{
+		case STATE_ENTITIES:
+			state = STATE_SCENE;
+			return true;
+		case STATE_FIELD_ARRAY:
+			if (numNumbers != field->numNumbers)
+			{
+				return fail( ("field " + field->name + " needs " + StringFuncs::toString( field->numNumbers ) +
+					" numbers").c_str() );
+			}
+			field->setNumbers( getStagedComponent(), numbers );
+			state = STATE_COMPONENT;
+			return true;
+		default:
+			return fail( "unexpected end of array" );
+		}
+	}
+
+	bool number( double value )
+	{
+		if (state == STATE_FIELD_ARRAY)
+		{
+			if (numNumbers == field->numNumbers)
+			{
+				return fail( ("field " + field->name + " has too many numbers").c_str() );
+			}
+			numbers[numNumbers++] = value;
+			return true;
+		}
+		if (state != STATE_EXPECT_FIELD_VALUE)
+		{
+			return fail( "unexpected number" );
+		}
+		if (field->numNumbers != 1)
+		{
+			return fail( ("field " + field->name + " doesn't take a single number").c_str() );
+		}
+		field->setNumbers( getStagedComponent(), &value );
+		state = STATE_COMPONENT;
+		return true;
+	}
+
+	bool string( const char *str, size_t length )
+	{
+		if (state != STATE_EXPECT_FIELD_VALUE)
+		{
+			return fail( "unexpected string" );
+		}
+		if (field->numNumbers != 0)
+		{
+			return fail( ("field " + field->name + " doesn't take a string").c_str() );
+		}
+		String value( str, length );
+		if (!field->setString( getStagedComponent(), value ))
+		{
+			return fail( ("\"" + value + "\" isn't a valid value for field " + field->name).c_str() );
+		}
+		state = STATE_COMPONENT;
+		return true;
+	}
+
+private:
+	enum State
+	{
+		STATE_EXPECT_SCENE,
+		STATE_SCENE,
+		STATE_EXPECT_ENTITIES,
+		STATE_ENTITIES,
+		STATE_ENTITY,
+		STATE_EXPECT_COMPONENT,
+		STATE_COMPONENT,
+		STATE_EXPECT_FIELD_VALUE,
+		STATE_FIELD_ARRAY,
+		STATE_DONE
+	};
+
+	const ECSSceneLoader &loader;
+	ECSSceneBatch *batch;
+	BatchSubmitter submitBatch;
+	State state = STATE_EXPECT_SCENE;
+	String error;
+	bool stopped = false;
+
+	// the entity being parsed.  Its components are staged in entityMemory until the entity is
+	// finished and it's known which batch it goes in
+	Array<BaseECSSceneComponentType*> entityTypes;
+	Array<BaseECSComponent*> entityComponents;
+	Array<Array<uint8>> entityMemory;
+
+	const BaseECSSceneComponentType::Field *field = nullptr;
+	double numbers[ECS_SCENE_MAX_FIELD_NUMBERS];
+	uint32 numNumbers = 0;
+
+	BaseECSComponent *getStagedComponent() { return entityComponents.back(); }
+
+	bool addComponent( const char *name, size_t length )
+	{
+		BaseECSSceneComponentType *type = loader.findComponentType( name, length );
+		if (type == nullptr)
+		{
+			return fail( ("unknown component type " + String( name, length )).c_str() );
+		}
+		for (uint32 i = 0; i < entityTypes.size(); i++)
+		{
+			if (entityTypes[i] == type)
+			{
+				return fail( ("entity has more than one " + type->getName()).c_str() );
+			}
+		}
+
+		uint32 componentID = type->getComponentID();
+		size_t alignment = BaseECSComponent::getTypeAlignment( componentID );
+		uint32 index = (uint32)entityTypes.size();
+		if (entityMemory.size() <= index)
+		{
+			entityMemory.resize( index + 1 );
+		}
+		entityMemory[index].resize( BaseECSComponent::getTypeSize( componentID ) + alignment );
+		BaseECSComponent *component = (BaseECSComponent*)Memory::align( entityMemory[index].data(), alignment );
+
+		BaseECSComponent::getTypeCreateFunction( componentID )( component, NULL_ENTITY_HANDLE, type->getPrototype() );
+		entityTypes.push_back( type );
+		entityComponents.push_back( component );
+		return true;
+	}
+
+	// moves the parsed entity into the batch
+	bool addEntity()
+	{
+		Array<uint32> &indices = scratchIndices;
+		if (batch->isFull() || !batch->matchTypes( entityTypes, indices ))
+		{
+			if (batch->getNumEntities() > 0 && !submit())
+			{
+				return false;
+			}
+			batch->setTypes( entityTypes );
+			batch->matchTypes( entityTypes, indices );
+		}
+
+		uint32 row = batch->addEntity();
+		for (uint32 i = 0; i < entityTypes.size(); i++)
+		{
+			BaseECSComponent::getTypeRelocateFunction( entityTypes[i]->getComponentID() )(
+				batch->getComponent( indices[i], row ), entityComponents[i] );
+		}
+		entityTypes.clear();
+		entityComponents.clear();
+		return true;
+	}
+	Array<uint32> scratchIndices;
+
+	bool submit()
+	{
+		batch = submitBatch( batch );
+		if (batch == nullptr)
+		{
+			stopped = true;
+			return false;
+		}
+		return true;
+	}
+
+	// frees the components of an entity which was only partly parsed
+	void freeEntity()
+	{
+		for (uint32 i = 0; i < entityTypes.size(); i++)
+		{
+			BaseECSComponent::getTypeFreeFunction( entityTypes[i]->getComponentID() )( entityComponents[i] );
+		}
+		entityTypes.clear();
+		entityComponents.clear();
+	}
+
+	NULL_COPY_AND_ASSIGN( ECSSceneParser );
+};
+
+//
+// Puts the entities of a batch into the ECS, moving the staged components into the new entities,
+// and empties the batch.  Returns false if the ECS couldn't make all of them
+//
+static bool makeBatchEntities( ECS &ecs, ECSSceneBatch &batch, Array<EntityHandle> &madeEntities )
+{
+	const Array<BaseECSSceneComponentType*> &types = batch.getTypes();
+	Array<BaseECSComponent*> prototypes( types.size() );
+	Array<uint32> componentIDs( types.size() );
+	for (uint32 i = 0; i < types.size(); i++)
+	{
+		prototypes[i] = types[i]->getPrototype();
+		componentIDs[i] = types[i]->getComponentID();
+	}
+
+	uint32 count = batch.getNumEntities();
+	size_t firstHandle = madeEntities.size();
+	madeEntities.resize( firstHandle + count );
+	uint32 numMade = ecs.makeEntities( count, prototypes.data(), componentIDs.data(), types.size(),
+		&madeEntities[firstHandle], [&batch, &componentIDs]( uint32 index, EntityHandle handle, BaseECSComponent **components )
+	{
+		// swap the prototype copy for the staged component
+		for (uint32 i = 0; i < componentIDs.size(); i++)
+		{
+			BaseECSComponent::getTypeFreeFunction( componentIDs[i] )( components[i] );
+			BaseECSComponent::getTypeRelocateFunction( componentIDs[i] )( components[i], batch.getComponent( i, index ) );
+			components[i]->entity = handle;
+		}
+	} );
+	madeEntities.resize( firstHandle + numMade );
+
+	// anything the ECS didn't take still has to be freed
+	batch.release( numMade );
+	return numMade == count;
+}
+
+//
+// Batches go back and forth between the parsing thread and the loading thread.
+// The parser waits for an empty batch when it gets ECS_SCENE_BATCHES_IN_FLIGHT ahead
+//
+class ECSSceneBatchQueue
+{
+public:
+	ECSSceneBatchQueue()
+	{
+		for (uint32 i = 0; i < ECS_SCENE_BATCHES_IN_FLIGHT; i++)
+		{
+			batches.push_back( new ECSSceneBatch() );
+			if (i > 0)
+			{
+				emptyBatches.push_back( batches.back() );
+			}
+		}
+	}
+	~ECSSceneBatchQueue()
+	{
+		for (uint32 i = 0; i < batches.size(); i++)
+		{
+			delete batches[i];
+		}
+	}
+
+	// the batch the parser starts with
+	ECSSceneBatch *getFirstBatch() { return batches[0]; }
+
+	// parsing thread: hands over a full batch and waits for an empty one
+	ECSSceneBatch *submit( ECSSceneBatch *batch )
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		fullBatches.push_back( batch );
+		changed.notify_all();
+		while (emptyBatches.empty() && !cancelled)
+		{
+			changed.wait( lock );
+		}
+		if (cancelled)
+		{
+			return nullptr;
+		}
+		ECSSceneBatch *emptyBatch = emptyBatches.front();
+		emptyBatches.pop_front();
+		return emptyBatch;
+	}
+
+	// parsing thread: nothing more is coming
+	void finish()
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		finished = true;
+		changed.notify_all();
+	}
+
+	// loading thread: waits for a full batch, returns null once parsing has finished
+	ECSSceneBatch *getFullBatch()
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		while (fullBatches.empty() && !finished)
+		{
+			changed.wait( lock );
+		}
+		if (fullBatches.empty())
+		{
+			return nullptr;
+		}
+		ECSSceneBatch *batch = fullBatches.front();
+		fullBatches.pop_front();
+		return batch;
+	}
+
+	// loading thread: done with the batch
+	void recycle( ECSSceneBatch *batch )
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		emptyBatches.push_back( batch );
+		changed.notify_all();
+	}
+
+	// loading thread: stops the parser at its next batch
+	void cancel()
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		cancelled = true;
+		changed.notify_all();
+	}
+
+private:
+	Array<ECSSceneBatch*> batches;
+	std::deque<ECSSceneBatch*> fullBatches;
+	std::deque<ECSSceneBatch*> emptyBatches;
+	bool finished = false;
+	bool cancelled = false;
+	std::mutex mutex;
+	std::condition_variable changed;
+
+	NULL_COPY_AND_ASSIGN( ECSSceneBatchQueue );
+};
+
+//
+// Runs the parser over the stream, returns an error message or an empty string if it worked
+//
+template<class Stream>
+static String parseScene( Stream &stream, ECSSceneParser &parser )
+{
+	ECSSceneHandler<ECSSceneParser> handler( parser );
+	rapidjson::Reader reader;
+	rapidjson::ParseResult result = reader.Parse( stream, handler );
+	if (result || parser.wasStopped())
+	{
+		return "";
+	}
+
+	String message = parser.getError().empty() ? rapidjson::GetParseError_En( result.Code() ) : parser.getError();
+	return message + " (at offset " + StringFuncs::toString( result.Offset() ) + ")";
+}
+
+template<class Stream>
+static bool loadScene( ECS &ecs, const ECSSceneLoader &loader, Stream &stream, bool parseOnThread, const String &sceneName )
+{
+	Array<EntityHandle> madeEntities;
+	String error;
+	bool madeAll = true;
+
+	if (parseOnThread)
+	{
+		ECSSceneBatchQueue queue;
+		std::thread parseThread( [&]()
+		{
+			ECSSceneParser parser( loader, queue.getFirstBatch(), [&queue]( ECSSceneBatch *batch )
+			{
+				return queue.submit( batch );
+			} );
+			error = parseScene( stream, parser );
+			queue.finish();
+		} );
+
+		// put each batch into the ECS while the next ones are parsed
+		while (ECSSceneBatch *batch = queue.getFullBatch())
+		{
+			if (madeAll && !makeBatchEntities( ecs, *batch, madeEntities ))
+			{
+				madeAll = false;
+				queue.cancel();
+			}
+			batch->release( 0 );
+			queue.recycle( batch );
+		}
+		parseThread.join();
+	}
+	else
+	{
+		ECSSceneBatch batch;
+		ECSSceneParser parser( loader, &batch, [&]( ECSSceneBatch *fullBatch )
+		{
+			madeAll = makeBatchEntities( ecs, *fullBatch, madeEntities );
+			return madeAll ? fullBatch : nullptr;
+		} );
+		error = parseScene( stream, parser );
+	}
+
+	if (!error.empty() || !madeAll)
+	{
+		if (!error.empty())
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "can't load scene %s: %s", sceneName.c_str(), error.c_str() );
+		}
+		else
+		{
+			DEBUG_LOG( "ECS", LOG_ERROR, "can't load scene %s: out of entity slots", sceneName.c_str() );
+		}
+		ecs.removeEntities( madeEntities.data(), madeEntities.size() );
+		return false;
+	}
+	return true;
+}
+
+bool ECSSceneLoader::loadFile( ECS &ecs, const String &fileName, bool parseOnThread )
+{
+	FILE *file = fopen( fileName.c_str(), "rb" );
+	if (file == nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "can't open scene %s", fileName.c_str() );
+		return false;
+	}
+
+	Array<char> buffer( ECS_SCENE_READ_BUFFER_SIZE );
+	rapidjson::FileReadStream stream( file, buffer.data(), buffer.size() );
+	bool loaded = loadScene( ecs, *this, stream, parseOnThread, fileName );
+	fclose( file );
+	return loaded;
+}
+
+bool ECSSceneLoader::loadString( ECS &ecs, const char *json )
+{
+	rapidjson::MemoryStream stream( json, strlen( json ) );
+	return loadScene( ecs, *this, stream, false, "string" );
+}
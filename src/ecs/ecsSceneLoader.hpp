@@ -0,0 +1,174 @@
+#pragma once
+//
+// Loads entities from JSON scene files:
+//
+//	{
+//		"entities": [
+//			{ "TransformComponent": { "translation": [0, 0, 20] }, "MotionComponent": { "velocity": [1, 0, 0] } },
+//			{ "TransformComponent": {} }
+//		]
+//	}
+//
+// The file is read with rapidjson's SAX reader, so there's never a DOM of the whole scene in memory:
+// entities are staged as they're parsed, and runs of entities with the same component types go
+// into the ECS together with makeEntities.
+// Component types (and the fields of each type the scene can set) are registered with the loader
+// by name.  Components start as a copy of the prototype they were registered with, and fields not in
+// the scene keep the prototype's values.
+//
+#include <functional>
+#include "ecs.hpp"
+#include "math/vector.hpp"
+#include "dataStructures/string.hpp"
+
+#define ECS_SCENE_BATCH_SIZE 1024		// most entities staged before they go into the ECS
+#define ECS_SCENE_MAX_FIELD_NUMBERS 16	// longest array of numbers a field can take
+#define ECS_SCENE_READ_BUFFER_SIZE (64 * 1024)
+
+class BaseECSSceneComponentType
+{
+public:
+	BaseECSSceneComponentType( const String &nameIn, uint32 componentIDIn ) :
+		name( nameIn ), componentID( componentIDIn ) {}
+	virtual ~BaseECSSceneComponentType() {}
+
+	const String &getName() const { return name; }
+	uint32 getComponentID() const { return componentID; }
+	virtual BaseECSComponent *getPrototype() = 0;
+
+	// set from a number, or an array of numFields numbers
+	typedef std::function<void( BaseECSComponent *component, const double *numbers )> NumberSetter;
+	// set from a string, returns false if the string isn't valid for the field
+	typedef std::function<bool( BaseECSComponent *component, const String &value )> StringSetter;
+
+	struct Field
+	{
+		String name;
+		uint32 numNumbers;		// 0 for string fields
+		NumberSetter setNumbers;
+		StringSetter setString;
+	};
+
+	// returns null if the type has no field with the name
+	const Field *findField( const char *fieldName, size_t length ) const;
+
+protected:
+	void addNumberField( const String &fieldName, uint32 numNumbers, const NumberSetter &setter );
+	void addStringField( const String &fieldName, const StringSetter &setter );
+
+private:
+	String name;
+	uint32 componentID;
+	Array<Field> fields;
+
+	NULL_COPY_AND_ASSIGN( BaseECSSceneComponentType );
+};
+
+template<class Component>
+class ECSSceneComponentType : public BaseECSSceneComponentType
+{
+public:
+	ECSSceneComponentType( const String &nameIn, const Component &prototypeIn ) :
+		BaseECSSceneComponentType( nameIn, Component::ID ), prototype( prototypeIn ) {}
+
+	virtual BaseECSComponent *getPrototype() override { return &prototype; }
+
+	// fields which are members of the component, returns the type so fields can be chained
+	ECSSceneComponentType &addField( const String &fieldName, float Component::*member )
+	{
+		return addField( fieldName, 1, [member]( Component &component, const double *numbers )
+		{
+			component.*member = (float)numbers[0];
+		} );
+	}
+	ECSSceneComponentType &addField( const String &fieldName, int32 Component::*member )
+	{
+		return addField( fieldName, 1, [member]( Component &component, const double *numbers )
+		{
+			component.*member = (int32)numbers[0];
+		} );
+	}
+	ECSSceneComponentType &addField( const String &fieldName, uint32 Component::*member )
+	{
+		return addField( fieldName, 1, [member]( Component &component, const double *numbers )
+		{
+			component.*member = (uint32)numbers[0];
+		} );
+	}
+	ECSSceneComponentType &addField( const String &fieldName, bool Component::*member )
+	{
+		return addField( fieldName, 1, [member]( Component &component, const double *numbers )
+		{
+			component.*member = numbers[0] != 0.0;
+		} );
+	}
+	ECSSceneComponentType &addField( const String &fieldName, Vector3f Component::*member )
+	{
+		return addField( fieldName, 3, [member]( Component &component, const double *numbers )
+		{
+			component.*member = Vector3f( (float)numbers[0], (float)numbers[1], (float)numbers[2] );
+		} );
+	}
+	ECSSceneComponentType &addField( const String &fieldName, String Component::*member )
+	{
+		return addStringField( fieldName, [member]( Component &component, const String &value )
+		{
+			component.*member = value;
+			return true;
+		} );
+	}
+
+	// fields which take more than setting a member, eg. a translation on a transform
+	ECSSceneComponentType &addField( const String &fieldName, uint32 numNumbers,
+		const std::function<void( Component &component, const double *numbers )> &setter )
+	{
+		addNumberField( fieldName, numNumbers, [setter]( BaseECSComponent *component, const double *numbers )
+		{
+			setter( *static_cast<Component*>(component), numbers );
+		} );
+		return *this;
+	}
+	ECSSceneComponentType &addStringField( const String &fieldName,
+		const std::function<bool( Component &component, const String &value )> &setter )
+	{
+		BaseECSSceneComponentType::addStringField( fieldName, [setter]( BaseECSComponent *component, const String &value )
+		{
+			return setter( *static_cast<Component*>(component), value );
+		} );
+		return *this;
+	}
+
+private:
+	Component prototype;
+};
+
+class ECSSceneLoader
+{
+public:
+	ECSSceneLoader() {}
+	~ECSSceneLoader();
+
+	template<class Component>
+	ECSSceneComponentType<Component> &addComponentType( const String &name, const Component &prototype = Component() )
+	{
+		ECSSceneComponentType<Component> *type = new ECSSceneComponentType<Component>( name, prototype );
+		addComponentType( type );
+		return *type;
+	}
+
+	// returns null if no component type has the name
+	BaseECSSceneComponentType *findComponentType( const char *name, size_t length ) const;
+
+	// Makes the entities in a scene file.  With parseOnThread, the file is parsed on a thread of its
+	// own while the calling thread puts the entities parsed so far into the ECS.
+	// Returns false (and makes no entities) if the scene can't be loaded
+	bool loadFile( ECS &ecs, const String &fileName, bool parseOnThread = true );
+	bool loadString( ECS &ecs, const char *json );
+
+private:
+	Array<BaseECSSceneComponentType*> componentTypes;
+
+	void addComponentType( BaseECSSceneComponentType *type );
+
+	NULL_COPY_AND_ASSIGN( ECSSceneLoader );
+};
@@ -0,0 +1,365 @@
+#include <cstdio>
+#include "math/math.hpp"
+#include "ecs.hpp"
+
+//
+// File layout, everything in native byte order:
+// header, a SnapshotType for every registered component type, a SnapshotEntity for every entity slot,
+// then for each (non-empty) archetype: a SnapshotArchetype, its component IDs, and for each chunk
+// the raw chunk memory followed by the size and data of any serialized components in it
+//
+struct SnapshotHeader
+{
+	uint32 magic;
+	uint32 version;
+	uint32 numComponentTypes;
+	uint32 numEntitySlots;
+	uint32 freeEntityList;
+	uint32 numEntities;
+	uint32 numArchetypes;
+};
+
+// enough about each component type to tell whether the snapshot was saved with the same types
+struct SnapshotType
+{
+	uint32 size;
+	uint32 alignment;
+	uint32 flags;
+	uint32 numFields;
+};
+
+struct SnapshotEntity
+{
+	uint32 archetype;	// index of the archetype in the snapshot, or NULL_ENTITY_HANDLE if the slot is free
+	uint32 row;
+	uint32 generation;
+};
+
+struct SnapshotArchetype
+{
+	uint32 numComponentTypes;
+	uint32 numEntities;
+	uint32 chunkCapacity;
+	uint32 chunkSize;
+};
+
+static SnapshotType getSnapshotType( uint32 componentID )
+{
+	SnapshotType type;
+	const ECSComponentFieldList *fields = BaseECSComponent::getTypeFields( componentID );
+	type.size = (uint32)BaseECSComponent::getTypeSize( componentID );
+	type.alignment = (uint32)BaseECSComponent::getTypeAlignment( componentID );
+	type.flags = BaseECSComponent::getTypeFlags( componentID );
+	type.numFields = fields != nullptr ? (uint32)fields->size() : 0;
+	return type;
+}
+
+// columns which can't be copied as raw bytes go through the type's snapshot hooks
+static bool isSerializedColumn( ECSArchetype &archetype, uint32 column )
+{
+	uint32 componentID = archetype.getComponentIDs()[column];
+	return !archetype.isSoAColumn( column ) &&
+		(BaseECSComponent::getTypeFlags( componentID ) & ECS_COMPONENT_TRIVIALLY_COPYABLE) == 0;
+}
+
+bool ECS::saveSnapshot( const String &fileName )
+{
+	// find out what's going in the snapshot (and whether it can all be saved) before touching the file
+	Array<ECSArchetype*> savedArchetypes;
+	Array<uint32> snapshotIndices( archetypes.size() );
+	for (uint32 i = 0; i < archetypes.size(); i++)
+	{
+		snapshotIndices[i] = (uint32)savedArchetypes.size();
+		if (archetypes[i]->getNumEntities() == 0)
+		{
+			continue;
+		}
+		for (uint32 j = 0; j < archetypes[i]->getComponentIDs().size(); j++)
+		{
+			uint32 componentID = archetypes[i]->getComponentIDs()[j];
+			if (isSerializedColumn( *archetypes[i], j ) && BaseECSComponent::getTypeSerializer( componentID ) == nullptr)
+			{
+				DEBUG_LOG( "ECS", LOG_ERROR, "component type %u can't be saved, it needs serialize hooks", componentID );
+				return false;
+			}
+		}
+		savedArchetypes.push_back( archetypes[i] );
+	}
+
+	FILE *file = fopen( fileName.c_str(), "wb" );
+	if (file == nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "could not open %s to save a snapshot", fileName.c_str() );
+		return false;
+	}
+
+	SnapshotHeader header;
+	header.magic = ECS_SNAPSHOT_MAGIC;
+	header.version = ECS_SNAPSHOT_VERSION;
+	header.numComponentTypes = BaseECSComponent::getNumTypes();
+	header.numEntitySlots = (uint32)entities.size();
+	header.freeEntityList = freeEntityList;
+	header.numEntities = numEntities;
+	header.numArchetypes = (uint32)savedArchetypes.size();
+	bool isWritten = fwrite( &header, sizeof( header ), 1, file ) == 1;
+
+	Array<SnapshotType> types( header.numComponentTypes );
+	for (uint32 i = 0; i < types.size(); i++)
+	{
+		types[i] = getSnapshotType( i );
+	}
+	isWritten = isWritten && fwrite( types.data(), sizeof( SnapshotType ), types.size(), file ) == types.size();
+
+	Array<SnapshotEntity> entityTable( entities.size() );
+	for (uint32 i = 0; i < entities.size(); i++)
+	{
+		entityTable[i].archetype = entities[i].archetype != nullptr ?
+			snapshotIndices[entities[i].archetype->getIndex()] : NULL_ENTITY_HANDLE;
+		entityTable[i].row = entities[i].row;
+		entityTable[i].generation = entities[i].generation;
+	}
+	isWritten = isWritten && fwrite( entityTable.data(), sizeof( SnapshotEntity ), entityTable.size(), file ) == entityTable.size();
+
+	Array<uint8> serialized;
+	for (uint32 i = 0; i < savedArchetypes.size() && isWritten; i++)
+	{
+		ECSArchetype &archetype = *savedArchetypes[i];
+		const Array<uint32> &componentIDs = archetype.getComponentIDs();
+		SnapshotArchetype archetypeHeader;
+		archetypeHeader.numComponentTypes = (uint32)componentIDs.size();
+		archetypeHeader.numEntities = archetype.getNumEntities();
+		archetypeHeader.chunkCapacity = archetype.getChunkCapacity();
+		archetypeHeader.chunkSize = (uint32)archetype.getChunkSize();
+		isWritten = fwrite( &archetypeHeader, sizeof( archetypeHeader ), 1, file ) == 1 &&
+			fwrite( componentIDs.data(), sizeof( uint32 ), componentIDs.size(), file ) == componentIDs.size();
+
+		for (uint32 j = 0; j < archetype.getNumChunks() && isWritten; j++)
+		{
+			ECSChunk &chunk = archetype.getChunk( j );
+			serialized.clear();
+			ECSSnapshotWriter writer( serialized );
+			for (uint32 k = 0; k < componentIDs.size(); k++)
+			{
+				if (!isSerializedColumn( archetype, k ))
+				{
+					continue;
+				}
+				const ECSComponentSerializer *serializer = BaseECSComponent::getTypeSerializer( componentIDs[k] );
+				uint8 *column = archetype.getColumn( chunk, k );
+				for (uint32 l = 0; l < chunk.numEntities; l++)
+				{
+					serializer->serialize( (BaseECSComponent*)(column + l * archetype.getColumnStride( k )), writer );
+				}
+			}
+
+			uint64 serializedSize = serialized.size();
+			isWritten = fwrite( chunk.memory, archetype.getChunkSize(), 1, file ) == 1 &&
+				fwrite( &serializedSize, sizeof( serializedSize ), 1, file ) == 1 &&
+				(serialized.empty() || fwrite( serialized.data(), serialized.size(), 1, file ) == 1);
+		}
+	}
+
+	isWritten = fclose( file ) == 0 && isWritten;
+	if (!isWritten)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "could not write the snapshot to %s", fileName.c_str() );
+	}
+	return isWritten;
+}
+
+//
+// Read each chunk straight into a new chunk of the matching archetype, then construct the serialized
+// components over the raw bytes saved for them.  The entity table is taken as it is, so handles from
+// before the snapshot was saved still work.
+//
+bool ECS::loadSnapshot( const String &fileName )
+{
+	if (numEntities != 0)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "snapshots can only be loaded into an ECS with no entities" );
+		return false;
+	}
+
+	FILE *file = fopen( fileName.c_str(), "rb" );
+	if (file == nullptr)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "could not open snapshot %s", fileName.c_str() );
+		return false;
+	}
+	// sizes read from the file are checked against what's left of it before anything is allocated for them
+	fseek( file, 0, SEEK_END );
+	long fileSize = ftell( file );
+	fseek( file, 0, SEEK_SET );
+
+	// the snapshot has to have been saved with the same component types
+	SnapshotHeader header;
+	bool isValid = fread( &header, sizeof( header ), 1, file ) == 1 && header.magic == ECS_SNAPSHOT_MAGIC &&
+		header.version == ECS_SNAPSHOT_VERSION && header.numComponentTypes == BaseECSComponent::getNumTypes() &&
+		header.numEntitySlots <= ECS_ENTITY_INDEX_MASK && header.numEntities <= header.numEntitySlots;
+	for (uint32 i = 0; i < header.numComponentTypes && isValid; i++)
+	{
+		SnapshotType type;
+		SnapshotType expectedType = getSnapshotType( i );
+		isValid = fread( &type, sizeof( type ), 1, file ) == 1 && Memory::memcmp( &type, &expectedType, sizeof( type ) ) == 0;
+	}
+
+	Array<SnapshotEntity> entityTable;
+	if (isValid)
+	{
+		entityTable.resize( header.numEntitySlots );
+		isValid = fread( entityTable.data(), sizeof( SnapshotEntity ), entityTable.size(), file ) == entityTable.size();
+	}
+
+	Array<ECSArchetype*> loadedArchetypes;
+	Array<uint32> componentIDs;
+	Array<uint8> serialized;
+	for (uint32 i = 0; i < header.numArchetypes && isValid; i++)
+	{
+		SnapshotArchetype archetypeHeader;
+		isValid = fread( &archetypeHeader, sizeof( archetypeHeader ), 1, file ) == 1 &&
+			archetypeHeader.numComponentTypes > 0 && archetypeHeader.numComponentTypes <= header.numComponentTypes;
+		if (isValid)
+		{
+			componentIDs.resize( archetypeHeader.numComponentTypes );
+			isValid = fread( componentIDs.data(), sizeof( uint32 ), componentIDs.size(), file ) == componentIDs.size();
+		}
+		for (uint32 j = 0; j < componentIDs.size() && isValid; j++)
+		{
+			isValid = componentIDs[j] < header.numComponentTypes && (j == 0 || componentIDs[j - 1] < componentIDs[j]);
+		}
+
+		// the same component types always get the same chunk layout
+		ECSArchetype *archetype = isValid ? findOrCreateArchetype( componentIDs ) : nullptr;
+		isValid = isValid && archetype->getNumEntities() == 0 &&
+			archetypeHeader.chunkCapacity == archetype->getChunkCapacity() &&
+			archetypeHeader.chunkSize == archetype->getChunkSize();
+		for (uint32 j = 0; isValid && j < componentIDs.size(); j++)
+		{
+			isValid = !isSerializedColumn( *archetype, j ) || BaseECSComponent::getTypeSerializer( componentIDs[j] ) != nullptr;
+		}
+		if (!isValid)
+		{
+			break;
+		}
+		loadedArchetypes.push_back( archetype );
+
+		uint32 numRowsLeft = archetypeHeader.numEntities;
+		while (numRowsLeft > 0 && isValid)
+		{
+			uint32 numRows = Math::min( numRowsLeft, archetype->getChunkCapacity() );
+			numRowsLeft -= numRows;
+			ECSChunk &chunk = archetype->addChunk( numRows );
+			uint64 serializedSize = 0;
+			isValid = isValid && fread( chunk.memory, archetype->getChunkSize(), 1, file ) == 1 &&
+				fread( &serializedSize, sizeof( serializedSize ), 1, file ) == 1 &&
+				serializedSize <= (uint64)(fileSize - ftell( file ));
+			serialized.resize( isValid ? (size_t)serializedSize : 0 );
+			isValid = isValid && (serialized.empty() || fread( serialized.data(), serialized.size(), 1, file ) == 1);
+
+			// everything the snapshot holds is new as far as change detection is concerned
+			uint32 *versions = archetype->getColumnVersions( chunk );
+			for (uint32 k = 0; k < componentIDs.size(); k++)
+			{
+				versions[k] = changeVersion;
+			}
+
+			// always construct every serialized component, even from bad data, so the chunk can be freed
+			ECSSnapshotReader reader( serialized.data(), serialized.size() );
+			EntityHandle *chunkEntities = archetype->getEntities( chunk );
+			for (uint32 k = 0; k < componentIDs.size(); k++)
+			{
+				if (!isSerializedColumn( *archetype, k ))
+				{
+					continue;
+				}
+				const ECSComponentSerializer *serializer = BaseECSComponent::getTypeSerializer( componentIDs[k] );
+				uint8 *column = archetype->getColumn( chunk, k );
+				for (uint32 l = 0; l < numRows; l++)
+				{
+					isValid = serializer->deserialize( column + l * archetype->getColumnStride( k ), chunkEntities[l], reader ) && isValid;
+				}
+			}
+		}
+	}
+	fclose( file );
+
+	// every row has to belong to a live entity, and every live entity has to be where the archetypes say it is
+	uint32 numRows = 0;
+	for (uint32 i = 0; i < loadedArchetypes.size() && isValid; i++)
+	{
+		ECSArchetype &archetype = *loadedArchetypes[i];
+		for (uint32 j = 0; j < archetype.getNumEntities() && isValid; j++)
+		{
+			isValid = handleToIndex( archetype.getEntity( j ) ) < entityTable.size();
+		}
+		numRows += archetype.getNumEntities();
+	}
+	isValid = isValid && numRows == header.numEntities;
+
+	uint32 numLive = 0;
+	for (uint32 i = 0; i < entityTable.size() && isValid; i++)
+	{
+		const SnapshotEntity &entity = entityTable[i];
+		if (entity.archetype == NULL_ENTITY_HANDLE)
+		{
+			isValid = entity.row == NULL_ENTITY_HANDLE || entity.row < entityTable.size();
+			continue;
+		}
+		isValid = entity.archetype < loadedArchetypes.size() &&
+			entity.row < loadedArchetypes[entity.archetype]->getNumEntities() &&
+			loadedArchetypes[entity.archetype]->getEntity( entity.row ) == makeHandle( i, entity.generation );
+		numLive++;
+	}
+	isValid = isValid && numLive == header.numEntities;
+
+	// the free list has to go through every free slot once, and nothing else
+	uint32 numFree = 0;
+	uint32 freeIndex = header.freeEntityList;
+	while (isValid && freeIndex != NULL_ENTITY_HANDLE)
+	{
+		isValid = freeIndex < entityTable.size() && entityTable[freeIndex].archetype == NULL_ENTITY_HANDLE &&
+			numFree < entityTable.size() - numLive;
+		if (isValid)
+		{
+			numFree++;
+			freeIndex = entityTable[freeIndex].row;
+		}
+	}
+	isValid = isValid && numFree == entityTable.size() - numLive;
+
+	if (!isValid)
+	{
+		DEBUG_LOG( "ECS", LOG_ERROR, "%s is not a valid snapshot for this ECS", fileName.c_str() );
+		for (uint32 i = 0; i < loadedArchetypes.size(); i++)
+		{
+			loadedArchetypes[i]->clear();
+		}
+		return false;
+	}
+
+	entities.resize( entityTable.size() );
+	for (uint32 i = 0; i < entityTable.size(); i++)
+	{
+		entities[i].archetype = entityTable[i].archetype != NULL_ENTITY_HANDLE ? loadedArchetypes[entityTable[i].archetype] : nullptr;
+		entities[i].row = entityTable[i].row;
+		entities[i].generation = entityTable[i].generation;
+	}
+	freeEntityList = header.freeEntityList;
+	numEntities = header.numEntities;
+
+	// listeners hear about each archetype's entities a chunk at a time
+	for (uint32 i = 0; i < loadedArchetypes.size(); i++)
+	{
+		ECSArchetype &archetype = *loadedArchetypes[i];
+		const Array<uint32> &interested = archetypeListeners[archetype.getIndex()];
+		for (uint32 j = 0; j < archetype.getNumChunks() && !interested.empty(); j++)
+		{
+			ECSChunk &chunk = archetype.getChunk( j );
+			for (uint32 k = 0; k < interested.size(); k++)
+			{
+				listeners[interested[k]]->onMakeEntities( archetype.getEntities( chunk ), chunk.numEntities );
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+//
+// A SNAPSHOT is a binary file holding everything in an ECS: the entity table and the archetype
+// chunks, stored as they are in memory so loading is a read straight into each chunk rather
+// than making the entities one at a time.
+//
+// Components which can't be stored as raw bytes (the ones which aren't trivially copyable)
+// need serialize hooks to be saved:
+//
+//	void serialize( ECSSnapshotWriter &writer ) const;
+//	bool deserialize( ECSSnapshotReader &reader );	// on a default constructed component, false if the data is bad
+//
+// Snapshots don't store component type names, so they can only be loaded by a build which
+// registers the same component types in the same order (this is checked when loading).
+//
+#include "core/common.hpp"
+#include "core/memory.hpp"
+#include "dataStructures/array.hpp"
+#include <type_traits>
+
+#define ECS_SNAPSHOT_MAGIC 0x53534345u		// "ECSS"
+#define ECS_SNAPSHOT_VERSION 1
+
+class ECSSnapshotWriter
+{
+public:
+	explicit ECSSnapshotWriter( Array<uint8> &outputIn ) : output( outputIn ) {}
+
+	void write( const void *data, size_t size )
+	{
+		if (size == 0)
+		{
+			return;
+		}
+		size_t offset = output.size();
+		output.resize( offset + size );
+		Memory::memcpy( &output[offset], data, size );
+	}
+
+	template<typename T>
+	void write( const T &value )
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only raw values can be written");
+		write( &value, sizeof( T ) );
+	}
+
+private:
+	Array<uint8> &output;
+
+	NULL_COPY_AND_ASSIGN( ECSSnapshotWriter );
+};
+
+class ECSSnapshotReader
+{
+public:
+	ECSSnapshotReader( const uint8 *dataIn, size_t sizeIn ) : data( dataIn ), numBytesLeft( sizeIn ) {}
+
+	// returns false (and reads nothing) if there isn't enough data left
+	bool read( void *output, size_t size )
+	{
+		if (size > numBytesLeft)
+		{
+			numBytesLeft = 0;
+			return false;
+		}
+		if (size == 0)
+		{
+			return true;
+		}
+		Memory::memcpy( output, data, size );
+		data += size;
+		numBytesLeft -= size;
+		return true;
+	}
+
+	template<typename T>
+	bool read( T &value )
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only raw values can be read");
+		return read( &value, sizeof( T ) );
+	}
+
+	size_t getNumBytesLeft() const { return numBytesLeft; }
+
+private:
+	const uint8 *data;
+	size_t numBytesLeft;
+
+	NULL_COPY_AND_ASSIGN( ECSSnapshotReader );
+};
@@ -1,10 +1,20 @@
 #include"ecsSystem.hpp"
+#include "core/memory.hpp"
 
 //
 // Check is system has a non-optional component
 //
 bool BaseECSSystem::isValid() const
 {
+	// the previous frame is only there to be read
+	for (uint32 i = 0; i < componentFlags.size(); i++)
+	{
+		if ((componentFlags[i] & FLAG_PREVIOUS_FRAME) && (componentFlags[i] & FLAG_READ_ONLY) == 0)
+		{
+			return false;
+		}
+	}
+
 	for (uint32 i = 0; i < componentFlags.size(); i++)
 	{
 		if ( (componentFlags[i] & FLAG_OPTIONAL) == 0)
@@ -16,6 +26,85 @@ bool BaseECSSystem::isValid() const
 	return false;
 }
 
+//
+// Hand the system each entity in turn.  SoA components are copied out of their field streams
+// for the update, and copied back afterwards unless the system only reads them
+//
+void BaseECSSystem::updateBatch( float delta, const ECSComponentBatch &batch )
+{
+	size_t soaSize = 0;
+	for (uint32 i = 0; i < batch.columns.size(); i++)
+	{
+		batch.componentParam[i] = nullptr;
+		if (batch.fields[i] != nullptr)
+		{
+			uint32 componentID = componentTypes[i];
+			soaSize = Memory::align( soaSize, BaseECSComponent::getTypeAlignment( componentID ) );
+			soaSize += BaseECSComponent::getTypeSize( componentID );
+		}
+	}
+	batch.soaComponents.resize( soaSize );
+	for (uint32 i = 0, offset = 0; i < batch.columns.size(); i++)
+	{
+		if (batch.fields[i] != nullptr)
+		{
+			offset = (uint32)Memory::align( offset, BaseECSComponent::getTypeAlignment( componentTypes[i] ) );
+			batch.componentParam[i] = (BaseECSComponent*)&batch.soaComponents[offset];
+			offset += (uint32)BaseECSComponent::getTypeSize( componentTypes[i] );
+		}
+	}
+
+	for (size_t row = 0; row < batch.count; row++)
+	{
+		for (uint32 i = 0; i < batch.columns.size(); i++)
+		{
+			if (batch.columns[i] != nullptr)
+			{
+				batch.componentParam[i] = (BaseECSComponent*)(batch.columns[i] + row * batch.strides[i]);
+			}
+			else if (batch.fields[i] != nullptr)
+			{
+				batch.readFields( i, row, batch.componentParam[i] );
+			}
+		}
+
+		updateComponents( delta, &batch.componentParam[0] );
+
+		for (uint32 i = 0; i < batch.columns.size(); i++)
+		{
+			if (batch.fields[i] != nullptr && (componentFlags[i] & FLAG_READ_ONLY) == 0)
+			{
+				batch.writeFields( i, row, batch.componentParam[i] );
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////
+// ECSComponentBatch
+///////////////////////////////////////////////////////
+
+void ECSComponentBatch::readFields( uint32 typeIndex, size_t row, BaseECSComponent *component ) const
+{
+	const ECSComponentFieldList &typeFields = *fields[typeIndex];
+	for (uint32 i = 0; i < typeFields.size(); i++)
+	{
+		Memory::memcpy( (uint8*)component + typeFields[i].offset,
+			fieldStreams[firstStream[typeIndex] + i] + row * typeFields[i].size, typeFields[i].size );
+	}
+	component->entity = entities[row];
+}
+
+void ECSComponentBatch::writeFields( uint32 typeIndex, size_t row, const BaseECSComponent *component ) const
+{
+	const ECSComponentFieldList &typeFields = *fields[typeIndex];
+	for (uint32 i = 0; i < typeFields.size(); i++)
+	{
+		Memory::memcpy( fieldStreams[firstStream[typeIndex] + i] + row * typeFields[i].size,
+			(const uint8*)component + typeFields[i].offset, typeFields[i].size );
+	}
+}
+
 ///////////////////////////////////////////////////////
 // ECSSystemList
 ///////////////////////////////////////////////////////
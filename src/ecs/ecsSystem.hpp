@@ -5,32 +5,158 @@
 //
 #include "ecsComponent.hpp"
 
+//
+// A contiguous run of components of a single type
+//
+template<typename Component>
+class ECSComponentSpan
+{
+public:
+	ECSComponentSpan( Component *dataIn, size_t countIn ) : data( dataIn ), count( countIn ) {}
+
+	// false for an optional component type the entities don't have
+	bool isValid() const { return data != nullptr; }
+	size_t size() const { return count; }
+	Component &operator[]( size_t index ) const { return data[index]; }
+	Component *begin() const { return data; }
+	Component *end() const { return data + count; }
+
+private:
+	Component *data;
+	size_t count;
+};
+
+//
+// The components of a run of entities which all have the same component types,
+// with one span per component type of the system (in the order the system added them).
+// Component types with a SoA layout have a span per field instead.
+//
+class ECSComponentBatch
+{
+public:
+	size_t size() const { return count; }
+
+	template<typename Component>
+	ECSComponentSpan<Component> get( uint32 typeIndex ) const
+	{
+		static_assert(!ECSComponentLayout<Component>::IS_SOA, "SoA components are read a field at a time with getField");
+		return ECSComponentSpan<Component>( (Component*)columns[typeIndex], count );
+	}
+
+	// the stream of one field of a SoA component type, eg. batch.getField( 1, &MotionComponent::velocity )
+	template<typename Component, typename FieldType>
+	ECSComponentSpan<FieldType> getField( uint32 typeIndex, FieldType Component::*member ) const
+	{
+		int32 field = findField( typeIndex, ECSComponentFields<Component>::getFieldOffset( member ) );
+		return ECSComponentSpan<FieldType>( field >= 0 ? (FieldType*)fieldStreams[firstStream[typeIndex] + field] : nullptr,
+			count );
+	}
+
+	// the entities the components belong to
+	ECSComponentSpan<const EntityHandle> getEntities() const
+	{
+		return ECSComponentSpan<const EntityHandle>( entities, count );
+	}
+
+private:
+	friend class ECSQuery;
+	friend class BaseECSSystem;
+
+	// the ECS reuses a batch for every run it updates, so these only grow
+	Array<uint8*> columns;						// start of each component type's span, nullptr if missing and optional
+	Array<size_t> strides;						// size of the components in each span
+	Array<const ECSComponentFieldList*> fields;	// fields of each SoA component type, null for other types
+	Array<uint32> firstStream;					// index of each SoA component type's first field stream
+	Array<uint8*> fieldStreams;
+	mutable Array<BaseECSComponent*> componentParam;	// used to update one entity at a time
+	mutable Array<uint8> soaComponents;			// whole copies of the SoA components, when updating one entity at a time
+	const EntityHandle *entities = nullptr;
+	size_t count = 0;
+
+	int32 findField( uint32 typeIndex, size_t offset ) const
+	{
+		for (uint32 i = 0; fields[typeIndex] != nullptr && i < fields[typeIndex]->size(); i++)
+		{
+			if ((*fields[typeIndex])[i].offset == offset)
+			{
+				return (int32)i;
+			}
+		}
+		return -1;
+	}
+
+	// copy a SoA component between its field streams and a whole component
+	void readFields( uint32 typeIndex, size_t row, BaseECSComponent *component ) const;
+	void writeFields( uint32 typeIndex, size_t row, const BaseECSComponent *component ) const;
+};
+
 class BaseECSSystem
 {
 public:
 	enum
 	{
-		FLAG_OPTIONAL = 1
+		FLAG_OPTIONAL = 1,
+		FLAG_READ_ONLY = 2,		// the system only reads this component type, so it can share it with other readers
+		FLAG_CHANGED = 4,		// only update chunks where a component of this type changed since the system last ran
+		FLAG_PREVIOUS_FRAME = 8	// with FLAG_READ_ONLY, read the copy from the last ECS::swapBuffers if the type is double buffered
 	};
 	// ctor
-	BaseECSSystem( const Array<uint32> &componentTypesIn ) : componentTypes( componentTypesIn ) {}
+	BaseECSSystem( const Array<uint32> &componentTypesIn ) : componentTypes( componentTypesIn ),
+		componentFlags( componentTypesIn.size() )
+	{
+		for (uint32 i = 0; i < componentTypes.size(); i++)
+		{
+			requiredMask.set( componentTypes[i] );
+		}
+	}
 	BaseECSSystem() {}
 
 	// TODO - should these compnents be const? since they should not be changed
 	virtual void updateComponents( float /*delta*/, BaseECSComponent ** /*components*/ ) {}
+
+	// Called once for every run of entities which have the components.  Override this instead of
+	// updateComponents to process the whole run in one loop; by default it calls updateComponents
+	// for each entity in turn.
+	virtual void updateBatch( float delta, const ECSComponentBatch &batch );
+
 	const Array<uint32>& getComponentTypes() { return componentTypes; }
 	const Array<uint32>& getComponentFlags() { return componentFlags; }
-	bool isValid() const;	// make sure the system has at least 1 non-optional component
+	// the non-optional and optional component types as masks, an entity can be updated by the
+	// system if its components contain the required mask
+	const ECSComponentMask &getRequiredMask() const { return requiredMask; }
+	const ECSComponentMask &getOptionalMask() const { return optionalMask; }
+	bool isValid() const;	// make sure the system has at least 1 non-optional component (and only reads previous frames)
+	bool isThreadSafe() const { return threadSafe; }
+	const char *getName() const { return name; }	// labels the system in profiles
 
 protected:
 	void addComponentType( uint32 componentType, uint32 componentFlag = 0 )
 	{
 		componentTypes.push_back( componentType );
 		componentFlags.push_back( componentFlag );
+		if (componentFlag & FLAG_OPTIONAL)
+		{
+			optionalMask.set( componentType );
+		}
+		else
+		{
+			requiredMask.set( componentType );
+		}
 	}
+
+	// call from the constructor if updateComponents only writes to the components it is given,
+	// so the ECS can split the entities between threads when it updates the system on a thread pool
+	void setThreadSafe( bool isThreadSafeIn ) { threadSafe = isThreadSafeIn; }
+
+	// the name isn't copied, so it has to outlive the system (eg. a string literal)
+	void setName( const char *nameIn ) { name = nameIn; }
 private:
 	Array<uint32> componentTypes;	// array of component IDs that this sytem operates on
 	Array<uint32> componentFlags;
+	ECSComponentMask requiredMask;
+	ECSComponentMask optionalMask;
+	bool threadSafe = false;
+	const char *name = "ECSSystem";
 };
 
 //
@@ -0,0 +1,73 @@
+#include <atomic>
+#include <algorithm>
+#include "ecsWorld.hpp"
+
+//
+// Fixed step: the clock builds up passed time and spends it a step at a time.  If the world
+// can't keep up, the time past maxStepsPerUpdate steps is dropped instead of piling up
+//
+uint32 ECSWorld::updateInternal( double passedTime, ThreadPool *threadPool )
+{
+	accumulatedTime += passedTime;
+	uint32 numStepsRun = 0;
+	while (accumulatedTime >= stepTime && numStepsRun < maxStepsPerUpdate)
+	{
+		stepInternal( threadPool );
+		accumulatedTime -= stepTime;
+		numStepsRun++;
+	}
+	if (accumulatedTime >= stepTime)
+	{
+		accumulatedTime = 0.0;
+	}
+	return numStepsRun;
+}
+
+void ECSWorld::stepInternal( ThreadPool *threadPool )
+{
+	if (threadPool != nullptr)
+	{
+		ecs.updateSystems( systems, stepTime, *threadPool );
+	}
+	else
+	{
+		ecs.updateSystems( systems, stepTime );
+	}
+	if (stepCallback)
+	{
+		stepCallback( *this, stepTime );
+	}
+	numSteps++;
+}
+
+bool ECSWorldGroup::removeWorld( ECSWorld &world )
+{
+	Array<ECSWorld*>::iterator it = std::find( worlds.begin(), worlds.end(), &world );
+	if (it == worlds.end())
+	{
+		return false;
+	}
+	worlds.erase( it );
+	return true;
+}
+
+//
+// A world whose systems go on the pool waits for just its own systems' tasks, and a thread which
+// waits helps run tasks, so worlds nested in pool tasks can't starve each other of threads
+//
+uint32 ECSWorldGroup::update( double passedTime, ThreadPool &threadPool )
+{
+	ThreadPool *systemPool = worlds.size() >= threadPool.getNumThreads() ? nullptr : &threadPool;
+	ThreadPool::TaskGroup group;
+	std::atomic<uint32> numSteps( 0 );
+	for (uint32 i = 0; i < worlds.size(); i++)
+	{
+		ECSWorld *world = worlds[i];
+		threadPool.addTask( [world, passedTime, systemPool, &numSteps]()
+		{
+			numSteps += world->updateInternal( passedTime, systemPool );
+		}, group );
+	}
+	threadPool.waitForTasks( group );
+	return numSteps;
+}
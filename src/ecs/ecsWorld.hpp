@@ -0,0 +1,86 @@
+#pragma once
+//
+// A WORLD is one independent simulation (a match on a server, a level being streamed in, ...):
+// its own ECS, with its own chunk memory, the systems which step it, and a fixed step clock.
+// Worlds don't share anything except the component type registry, which is read only once the
+// types are registered, so any number of them can be stepped at the same time with an ECSWorldGroup.
+//
+// Each world needs its own system objects.  A system keeps its state (and its name for the
+// profiler) in the object, so one system in two worlds stepping at once would race with itself.
+//
+#include <functional>
+#include "ecs.hpp"
+#include "core/threadPool.hpp"
+
+#define ECS_WORLD_MAX_STEPS_PER_UPDATE 4	// a world that falls further behind than this drops the time
+
+class ECSWorld
+{
+public:
+	explicit ECSWorld( float stepTimeIn, uint32 maxStepsPerUpdateIn = ECS_WORLD_MAX_STEPS_PER_UPDATE ) :
+		stepTime( stepTimeIn ), maxStepsPerUpdate( maxStepsPerUpdateIn ) {}
+
+	ECS &getECS() { return ecs; }
+	ECSSystemList &getSystems() { return systems; }
+
+	// called after the systems every step, for work which isn't a system (a transform hierarchy,
+	// applying a command buffer, ...)
+	typedef std::function<void( ECSWorld &world, float delta )> StepCallback;
+	void setStepCallback( const StepCallback &callback ) { stepCallback = callback; }
+
+	// Moves the clock on by passedTime and runs every step which is due, up to maxStepsPerUpdate,
+	// with the systems on the calling thread or spread over the thread pool.
+	// Returns the number of steps run
+	uint32 update( double passedTime ) { return updateInternal( passedTime, nullptr ); }
+	uint32 update( double passedTime, ThreadPool &threadPool ) { return updateInternal( passedTime, &threadPool ); }
+
+	// runs one step straight away, whatever the clock says
+	void step() { stepInternal( nullptr ); }
+	void step( ThreadPool &threadPool ) { stepInternal( &threadPool ); }
+
+	float getStepTime() const { return stepTime; }
+	uint64 getNumSteps() const { return numSteps; }
+	// how far the clock is into the next step (0 to 1), for interpolating between steps
+	float getStepFraction() const { return (float)(accumulatedTime / stepTime); }
+
+private:
+	ECS ecs;
+	ECSSystemList systems;
+	StepCallback stepCallback;
+	float stepTime;
+	uint32 maxStepsPerUpdate;
+	double accumulatedTime = 0.0;
+	uint64 numSteps = 0;
+	friend class ECSWorldGroup;
+
+	// a null thread pool runs the systems on the calling thread
+	uint32 updateInternal( double passedTime, ThreadPool *threadPool );
+	void stepInternal( ThreadPool *threadPool );
+
+	NULL_COPY_AND_ASSIGN( ECSWorld );
+};
+
+//
+// Steps a set of worlds together on one thread pool, each world as a task of its own on its own clock.
+// With at least a world per thread the worlds keep the pool busy by themselves, so each one runs its
+// systems on the thread which picked it up instead of paying to split them into more tasks.
+// With fewer worlds than threads, their systems are spread over the pool as well.
+//
+class ECSWorldGroup
+{
+public:
+	ECSWorldGroup() {}
+
+	void addWorld( ECSWorld &world ) { worlds.push_back( &world ); }
+	bool removeWorld( ECSWorld &world );
+	size_t getNumWorlds() const { return worlds.size(); }
+
+	// Moves every world's clock on by passedTime and runs their due steps at the same time.
+	// Returns the number of steps run over all the worlds
+	uint32 update( double passedTime, ThreadPool &threadPool );
+
+private:
+	Array<ECSWorld*> worlds;
+
+	NULL_COPY_AND_ASSIGN( ECSWorldGroup );
+};
@@ -10,6 +10,7 @@
 #include "gameCS/renderableMesh.hpp"
 #include "gameCS/movementControl.hpp"
 #include "gameCS/motion.hpp"
+#include <fstream>
 
 void Game::gameLoop()
 {
@@ -36,33 +37,63 @@ void Game::gameLoop()
 			fps = 0;
 		}
 
-		bool shouldRender = false;
+		// The input is read on this thread before the simulation starts, so the systems never see it change.
+		// Every step of the frame runs with the input as it is after the last of these: it can't be
+		// read between the steps, which run on the pool while this thread renders
+		uint32 numSteps = 0;
 		while (updateTimer >= frameTime)
 		{
 			app->processMessages(frameTime, gameEventHandler);
-			ecs.updateSystems(mainSystems, frameTime);
 			updateTimer -= frameTime;
-			shouldRender = true;
+			numSteps++;
 		}
 
-		if (shouldRender)
+		if (numSteps > 0)
 		{
-			gameRenderContext->clear(color, true);
-			ecs.updateSystems(renderingPipeline, frameTime);
-			gameRenderContext->flush();
-			window->present();
+			// the last frame is rendered while the pool works out the next one.
+			// Rendering talks to the GL context, so it stays on this thread
+			framePipeline.runFrame([this, numSteps, frameTime]()
+			{
+				for (uint32 i = 0; i < numSteps; i++)
+				{
+					ecs.updateSystems(mainSystems, frameTime, threadPool);
+					transformHierarchy.update();
+				}
+			}, [this, &color, frameTime]()
+			{
+				gameRenderContext->clear(color, true);
+				framePipeline.updateRenderSystems(frameTime);
+				gameRenderContext->flush();
+				window->present();
+			}, threadPool);
 			fps++;
+#ifdef ECS_PROFILING
+			ecs.getProfiler().nextFrame();
+#endif
 		}
 		else
 		{
+			// nothing to do yet, spend a little of the spare time tidying up the ECS memory
+			ecs.defragment(0.0005);
 			Time::sleep(1);
 		}
 	}
+
+#ifdef ECS_PROFILING
+	// the last few seconds of system updates, for chrome://tracing
+	String trace;
+	ecs.getProfiler().writeChromeTrace(trace);
+	std::ofstream traceFile("./ecsTrace.json");
+	traceFile << trace;
+#endif
 }
 
 int Game::loadAndRunScene(RenderDevice &device)
 {
 	// BEGIN SCENE CREATION
+	// rendering reads the last frame's world matrices while the next frame moves things
+	ecs.setDoubleBuffered<WorldTransformComponent>();
+
 	Array<IndexedModel> models;
 	Array<uint32> modelMaterialIndices;
 	Array<MaterialSpec> modelMaterials;
@@ -136,21 +167,31 @@ int Game::loadAndRunScene(RenderDevice &device)
 
 	//Create entities
 	MotionComponent motionComponent;
-	ecs.makeEntity(transformComponent, movementControl, renderableMeshComponent);
-	for (uint32 i = 0; i < 5000; i++)
+	WorldTransformComponent worldTransformComponent;
+	EntityHandle player = ecs.makeEntity(transformComponent, movementControl, renderableMeshComponent, worldTransformComponent);
+
+	// a cube which goes wherever the player goes
+	TransformComponent attachedTransform;
+	attachedTransform.transform = Transform(Vector3f(2, 0, 0), Quaternion(0, 0, 0, 1), Vector3f(0.5f, 0.5f, 0.5f));
+	ParentComponent attachedParent;
+	attachedParent.parent = player;
+	renderableMeshComponent.vertexArray = &tinyCubeVertexArray;
+	renderableMeshComponent.texture = &bricks2Texture;
+	ecs.makeEntity(attachedTransform, attachedParent, renderableMeshComponent, worldTransformComponent);
+
+	ECSPrefab cubePrefab(transformComponent, motionComponent, renderableMeshComponent, worldTransformComponent);
+	ecs.instantiate<TransformComponent, MotionComponent, RenderableMeshComponent>(cubePrefab, 5000, nullptr,
+		[&](uint32 index, TransformComponent &transform, MotionComponent &motion, RenderableMeshComponent &renderableMesh)
 	{
-		transformComponent.transform.setTranslation(Vector3f(Math::randf()*10.f - 5.f,
+		transform.transform.setTranslation(Vector3f(Math::randf()*10.f - 5.f,
 			Math::randf()*10.f - 5.f, Math::randf()*10.f - 5.f + 20.f));
-		renderableMeshComponent.vertexArray = &tinyCubeVertexArray;
-		renderableMeshComponent.texture = Math::randf() > .5f ? &texture : &bricks2Texture;
+		renderableMesh.texture = Math::randf() > .5f ? &texture : &bricks2Texture;
 
 		float vf = -4.0f;
 		float af = 5.0f;
-		motionComponent.acceleration = Vector3f(Math::randf(-af, af), Math::randf(-af, af), Math::randf(-af, af));
-		motionComponent.velocity = motionComponent.acceleration * vf;
-
-		ecs.makeEntity(transformComponent, motionComponent, renderableMeshComponent);
-	}
+		motion.acceleration = Vector3f(Math::randf(-af, af), Math::randf(-af, af), Math::randf(-af, af));
+		motion.velocity = motion.acceleration * vf;
+	});
 
 	// Create the systems
 	MovementControlSystem movementControlSystem;
@@ -160,6 +201,10 @@ int Game::loadAndRunScene(RenderDevice &device)
 	mainSystems.addSystem(motionSystem);
 	renderingPipeline.addSystem(renderableMeshSystem);
 
+	// the first frame renders what's in the previous frame copies, so they need world matrices in them
+	transformHierarchy.update();
+	ecs.swapBuffers();
+
 	gameLoop();
 	return 0;
 }
@@ -2,15 +2,19 @@
 
 #include "core/application.hpp"
 #include "core/window.hpp"
+#include "core/threadPool.hpp"
 #include "ecs/ecs.hpp"
+#include "ecs/ecsFramePipeline.hpp"
 #include "gameEventHandler.hpp"
 #include "gameRenderContext.hpp"
+#include "gameCS/transformHierarchy.hpp"
 
 class Game
 {
 public:
 	Game(Application *appIn, Window *windowIn, GameRenderContext *gameRenderContextIn) :
-		app(appIn), window(windowIn), gameRenderContext(gameRenderContextIn) { }
+		app(appIn), window(windowIn), gameRenderContext(gameRenderContextIn), transformHierarchy(ecs),
+		framePipeline(ecs, mainSystems, renderingPipeline) { }
 	int loadAndRunScene(RenderDevice &device);
 	void gameLoop();
 private:
@@ -19,8 +23,11 @@ private:
 	GameRenderContext *gameRenderContext;	// for drawing
 	GameEventHandler gameEventHandler;
 	ECS ecs;
+	ThreadPool threadPool;
 	ECSSystemList mainSystems;
 	ECSSystemList renderingPipeline;
+	TransformHierarchySystem transformHierarchy;	// world matrices for rendering, after mainSystems have moved things
+	ECSFramePipeline framePipeline;		// renders a frame while the next one is simulated
 };
 
 
@@ -8,6 +8,13 @@ struct MotionComponent : public ECSComponent<MotionComponent>
 {
 	Vector3f velocity = Vector3f(0, 0, 0);
 	Vector3f acceleration = Vector3f(0, 0, 0);
+
+	// store velocities and accelerations in separate streams, so the integrator can run over them
+	static void declareFields(ECSComponentFields<MotionComponent> &fields)
+	{
+		fields.add(&MotionComponent::velocity);
+		fields.add(&MotionComponent::acceleration);
+	}
 };
 
 class MotionSystem : public BaseECSSystem
@@ -18,16 +25,22 @@ public:
 	{
 		addComponentType(TransformComponent::ID);
 		addComponentType(MotionComponent::ID);
+		setThreadSafe(true);
+		setName("MotionSystem");
 	}
 
-	// use the 2 components to calculate a new transform position
-	virtual void updateComponents(float delta, BaseECSComponent **components) override
+	// use the 2 components to calculate a new transform position,
+	// for a whole run of entities at once so the integrator can be inlined into the loop
+	virtual void updateBatch(float delta, const ECSComponentBatch &batch) override
 	{
-		TransformComponent *transform = (TransformComponent*)components[0];
-		MotionComponent *motion = (MotionComponent*)components[1];
-
-		Vector3f newPos = transform->transform.getTranslation();
-		MotionIntegrators::forestRuth(newPos, motion->velocity, motion->acceleration, delta);
-		transform->transform.setTranslation(newPos);
+		ECSComponentSpan<TransformComponent> transforms = batch.get<TransformComponent>(0);
+		ECSComponentSpan<Vector3f> velocities = batch.getField(1, &MotionComponent::velocity);
+		ECSComponentSpan<Vector3f> accelerations = batch.getField(1, &MotionComponent::acceleration);
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			Vector3f newPos = transforms[i].transform.getTranslation();
+			MotionIntegrators::forestRuth(newPos, velocities[i], accelerations[i], delta);
+			transforms[i].transform.setTranslation(newPos);
+		}
 	}
 };
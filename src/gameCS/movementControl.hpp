@@ -16,7 +16,9 @@ public:
 	MovementControlSystem() : BaseECSSystem()
 	{
 		addComponentType(TransformComponent::ID);
-		addComponentType(MovementControlComponent::ID);
+		addComponentType(MovementControlComponent::ID, BaseECSSystem::FLAG_READ_ONLY);
+		setThreadSafe(true);	// only reads the input controls
+		setName("MovementControlSystem");
 	}
 
 	// use the 2 components to calculate a new transform position
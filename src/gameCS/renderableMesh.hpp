@@ -2,7 +2,7 @@
 
 #include "ecs/ecs.hpp"
 #include "rendering/renderContext.hpp"
-#include "gameCS/utilComponents.hpp"
+#include "gameCS/transformHierarchy.hpp"
 
 struct RenderableMeshComponent : public ECSComponent<RenderableMeshComponent>
 {
@@ -10,26 +10,26 @@ struct RenderableMeshComponent : public ECSComponent<RenderableMeshComponent>
 	Texture *texture = nullptr;
 };
 
-
 class RenderableMeshSystem : public BaseECSSystem
 {
 public:
-	// add the 2 component types (in order) that this system works on
+	// add the component type that this system works on
 	RenderableMeshSystem(GameRenderContext &contextIn) : BaseECSSystem(),
 		context(contextIn)
 	{
-		addComponentType(TransformComponent::ID);
-		addComponentType(RenderableMeshComponent::ID);
+		addComponentType(WorldTransformComponent::ID, BaseECSSystem::FLAG_READ_ONLY | BaseECSSystem::FLAG_PREVIOUS_FRAME);
+		addComponentType(RenderableMeshComponent::ID, BaseECSSystem::FLAG_READ_ONLY);
+		setName("RenderableMeshSystem");
 	}
 
-	// use the 2 components to calculate a new transform position
+	// draw the mesh with the world matrix TransformHierarchySystem worked out, as of the last swap if
+	// world transforms are double buffered
 	virtual void updateComponents(float delta, BaseECSComponent **components) override
 	{
-		TransformComponent *transform = (TransformComponent*)components[0];
+		WorldTransformComponent *world = (WorldTransformComponent*)components[0];
 		RenderableMeshComponent *mesh = (RenderableMeshComponent*)components[1];
 
-		context.renderMesh(*mesh->vertexArray, *mesh->texture,
-			transform->transform.toMatrix());
+		context.renderMesh(*mesh->vertexArray, *mesh->texture, world->worldMatrix);
 	}
 private:
 	GameRenderContext & context;
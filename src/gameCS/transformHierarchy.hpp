@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include "ecs/ecs.hpp"
+#include "gameCS/utilComponents.hpp"
+
+// makes the entity's transform relative to its parent's
+struct ParentComponent : public ECSComponent<ParentComponent>
+{
+	EntityHandle parent = NULL_ENTITY_HANDLE;
+	uint32 parentVersion = 0;	// version of the parent's world matrix the entity's was last worked out from
+};
+
+// the entity's transform in world space, worked out by TransformHierarchySystem from its own transform
+// and its parents'.  Anything that needs the transform as a matrix (rendering, colliders) uses this
+// instead of building it from the transform every frame
+struct WorldTransformComponent : public ECSComponent<WorldTransformComponent>
+{
+	Matrix worldMatrix = Matrix::identity();
+	uint32 version = 0;		// the TransformHierarchySystem update which last changed worldMatrix
+};
+
+//
+// Keeps the world matrices of everything with a TransformComponent and a WorldTransformComponent up to date.
+// Roots (entities without a parent) are updated a chunk at a time, skipping chunks where no transform
+// changed.  Children are kept in a list sorted by depth, so parents are always done before their
+// children, and a child's matrix is only rebuilt if its own transform or its parent's world matrix
+// changed; a still subtree costs a version check per node instead of a matrix build.
+// Call update once the systems which move things have run.
+//
+// It isn't a BaseECSSystem, since the child pass has to go in depth order over the whole ECS rather
+// than a chunk at a time, so the ECS knows nothing about it:
+// - its updates don't show up in the ECS profiler
+// - updateSystems can't schedule it, so call it between system updates, never alongside them
+// - ECSFramePipeline::canOverlap can't see that it writes WorldTransformComponent, so in a pipeline
+//   WorldTransformComponent has to be double buffered and only read from the previous frame
+// Children also aren't stored in depth order, so each child costs four constant time component
+// lookups per update, even when nothing in its subtree moved.
+//
+class TransformHierarchySystem : public ECSListener
+{
+public:
+	TransformHierarchySystem(ECS &ecsIn) : ecs(ecsIn), rootQuery(makeRootQuery(ecsIn))
+	{
+		addComponentId(ParentComponent::ID);
+		ecs.addListener(this);
+	}
+
+	void update()
+	{
+		uint32 sinceVersion = lastChangeVersion;
+		lastChangeVersion = ecs.advanceChangeVersion();
+		updateCount++;
+		numChanged = 0;
+
+		updateRoots(sinceVersion);
+		bool wasOrderStale = isOrderStale;
+		if (isOrderStale)
+		{
+			sortChildren();
+		}
+		updateChildren(sinceVersion, wasOrderStale);
+	}
+
+	// a new parent means the depth order has to be worked out again
+	void setParent(EntityHandle child, EntityHandle parent)
+	{
+		ParentComponent *parentComponent = ecs.getComponent<ParentComponent>(child);
+		if (parentComponent == nullptr)
+		{
+			ParentComponent newParent;
+			newParent.parent = parent;
+			ecs.addComponent(child, &newParent);
+			return;
+		}
+		parentComponent->parent = parent;
+		isOrderStale = true;
+	}
+
+	// how many world matrices the last update changed, roots and children
+	uint32 getNumChanged() const { return numChanged; }
+
+	virtual void onMakeEntities(const EntityHandle *handles, size_t numHandles) override { isOrderStale = true; }
+	virtual void onRemoveEntities(const EntityHandle *handles, size_t numHandles) override { isOrderStale = true; }
+	virtual void onAddComponent(EntityHandle handle, uint32 id) override { isOrderStale = true; }
+	virtual void onRemoveComponent(EntityHandle handle, uint32 id) override { isOrderStale = true; }
+
+private:
+	ECS &ecs;
+	ECSQuery &rootQuery;
+	ECSComponentBatch batch;
+	Array<EntityHandle> children;	// sorted by depth
+	bool isOrderStale = true;
+	uint32 lastChangeVersion = 0;
+	uint32 updateCount = 0;
+	uint32 numChanged = 0;
+
+	static ECSQuery &makeRootQuery(ECS &ecs)
+	{
+		Array<uint32> componentTypes;
+		Array<uint32> componentFlags;
+		componentTypes.push_back(TransformComponent::ID);
+		componentFlags.push_back(BaseECSSystem::FLAG_READ_ONLY | BaseECSSystem::FLAG_CHANGED);
+		componentTypes.push_back(WorldTransformComponent::ID);
+		componentFlags.push_back(0);
+		return ecs.query(componentTypes, componentFlags);
+	}
+
+	bool setWorldMatrix(WorldTransformComponent &world, const Matrix &worldMatrix)
+	{
+		if (world.worldMatrix == worldMatrix)
+		{
+			return false;
+		}
+		world.worldMatrix = worldMatrix;
+		world.version = updateCount;
+		numChanged++;
+		return true;
+	}
+
+	void updateRoots(uint32 sinceVersion)
+	{
+		for (uint32 i = 0; i < rootQuery.getNumArchetypes(); i++)
+		{
+			ECSArchetype &archetype = rootQuery.getArchetype(i);
+			if (archetype.hasComponent(ParentComponent::ID))
+			{
+				continue;
+			}
+			for (uint32 j = 0; j < archetype.getNumChunks(); j++)
+			{
+				ECSChunk &chunk = archetype.getChunk(j);
+				if (!rootQuery.hasChanged(i, chunk, sinceVersion))
+				{
+					continue;
+				}
+
+				rootQuery.getBatch(i, chunk, batch);
+				ECSComponentSpan<TransformComponent> transforms = batch.get<TransformComponent>(0);
+				ECSComponentSpan<WorldTransformComponent> worlds = batch.get<WorldTransformComponent>(1);
+				bool changed = false;
+				for (size_t k = 0; k < batch.size(); k++)
+				{
+					changed |= setWorldMatrix(worlds[k], transforms[k].transform.toMatrix());
+				}
+				if (changed)
+				{
+					rootQuery.markWritten(i, chunk, ecs.getCurrentChangeVersion());
+				}
+			}
+		}
+	}
+
+	// children with a parent that isn't in the hierarchy (or a loop of parents) count as depth 1
+	uint32 getDepth(EntityHandle child)
+	{
+		uint32 depth = 1;
+		ParentComponent *parent = ecs.getComponent<ParentComponent>(child);
+		while (parent != nullptr && (parent = ecs.getComponent<ParentComponent>(parent->parent)) != nullptr)
+		{
+			if (++depth > children.size())
+			{
+				DEBUG_LOG("ECS", LOG_WARNING, "entity %u is in a loop of parents", child);
+				return 1;
+			}
+		}
+		return depth;
+	}
+
+	void sortChildren()
+	{
+		children.clear();
+		ecs.query<ParentComponent>().forEachBatch([this](const ECSComponentBatch &parentBatch)
+		{
+			for (size_t i = 0; i < parentBatch.size(); i++)
+			{
+				children.push_back(parentBatch.getEntities()[i]);
+			}
+		});
+
+		Array<std::pair<uint32, EntityHandle>> depths(children.size());
+		for (uint32 i = 0; i < children.size(); i++)
+		{
+			depths[i] = std::make_pair(getDepth(children[i]), children[i]);
+		}
+		std::sort(depths.begin(), depths.end());
+		for (uint32 i = 0; i < children.size(); i++)
+		{
+			children[i] = depths[i].second;
+		}
+		isOrderStale = false;
+	}
+
+	void updateChildren(uint32 sinceVersion, bool updateAll)
+	{
+		for (uint32 i = 0; i < children.size(); i++)
+		{
+			ParentComponent *parent = ecs.getComponent<ParentComponent>(children[i]);
+			TransformComponent *transform = ecs.getComponent<TransformComponent>(children[i]);
+			WorldTransformComponent *world = ecs.getComponent<WorldTransformComponent>(children[i]);
+			if (parent == nullptr || transform == nullptr || world == nullptr)
+			{
+				continue;
+			}
+
+			// a parent with no world matrix leaves the child's transform in world space
+			WorldTransformComponent *parentWorld = ecs.getComponent<WorldTransformComponent>(parent->parent);
+			uint32 parentVersion = parentWorld != nullptr ? parentWorld->version : 0xFFFFFFFFu;
+			if (!updateAll && parent->parentVersion == parentVersion &&
+				ecs.getChangeVersion<TransformComponent>(children[i]) <= sinceVersion)
+			{
+				continue;
+			}
+
+			parent->parentVersion = parentVersion;
+			Matrix localMatrix = transform->transform.toMatrix();
+			if (setWorldMatrix(*world, parentWorld != nullptr ? parentWorld->worldMatrix * localMatrix : localMatrix))
+			{
+				ecs.markChanged<WorldTransformComponent>(children[i]);
+			}
+		}
+	}
+
+	NULL_COPY_AND_ASSIGN(TransformHierarchySystem);
+};
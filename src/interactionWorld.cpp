@@ -13,6 +13,15 @@ void InteractionWorld::onMakeEntity(EntityHandle handle)
 	addEntity(handle);
 }
 
+void InteractionWorld::onMakeEntities(const EntityHandle *handles, size_t numHandles)
+{
+	entities.reserve(entities.size() + numHandles);
+	for (size_t i = 0; i < numHandles; i++)
+	{
+		addEntity(handles[i]);
+	}
+}
+
 void InteractionWorld::onRemoveEntity(EntityHandle handle)
 {
 	entitiesToRemove.push_back(handle);
@@ -22,7 +31,7 @@ void InteractionWorld::onAddComponent(EntityHandle handle, uint32 id)
 {
 	if (id == TransformComponent::ID)
 	{
-		if (ecs.getComponent<ColliderComponent>(handle) != nullptr)
+		if (ecs.hasComponent<ColliderComponent>(handle))
 		{
 			addEntity(handle);
 		}
@@ -30,7 +39,7 @@ void InteractionWorld::onAddComponent(EntityHandle handle, uint32 id)
 
 	if (id == ColliderComponent::ID)
 	{
-		if (ecs.getComponent<TransformComponent>(handle) != nullptr)
+		if (ecs.hasComponent<TransformComponent>(handle))
 		{
 			addEntity(handle);
 		}
@@ -59,30 +68,11 @@ void InteractionWorld::addEntity(EntityHandle handle)
 void InteractionWorld::computeInteractions(EntityInternal &entity, uint32 interactionIndex)
 {
 	Interaction * interaction = interactions[interactionIndex];
-	
-	bool isInteractor = true;
-	for (size_t i = 0; i < interaction->getInteractorComponents().size(); i++)
-	{
-		if (ecs.getComponentByType(entity.handle, interaction->getInteractorComponents()[i]) == nullptr)
-		{
-			isInteractor = false;
-			break;
-		}
-	}
-
-	bool isInteractee = true;
-	for (size_t i = 0; i < interaction->getInteracteeComponents().size(); i++)
-	{
-		if (ecs.getComponentByType(entity.handle, interaction->getInteracteeComponents()[i]) == nullptr)
-		{
-			isInteractee = false;
-			break;
-		}
-	}
+	ECSComponentMask entityMask = ecs.getComponentMask(entity.handle);
 
-	if (isInteractor)
+	if (entityMask.contains(interaction->getInteractorMask()))
 		entity.interactors.push_back(interactionIndex);
-	if (isInteractor)
+	if (entityMask.contains(interaction->getInteracteeMask()))
 		entity.interactees.push_back(interactionIndex);
 }
 
@@ -10,18 +10,24 @@ public:
 		BaseECSComponent **interacteeComponents) { }
 	const Array<uint32> &getInteractorComponents() const { return interactorComponents; }
 	const Array<uint32> &getInteracteeComponents() const { return interacteeComponents; }
+	const ECSComponentMask &getInteractorMask() const { return interactorMask; }
+	const ECSComponentMask &getInteracteeMask() const { return interacteeMask; }
 protected:
 	void addInteractorComponentType(uint32 type)
 	{
 		interactorComponents.push_back(type);
+		interactorMask.set(type);
 	}
 	void addInteracteeComponentType(uint32 type)
 	{
 		interacteeComponents.push_back(type);
+		interacteeMask.set(type);
 	}
 private:
 	Array<uint32> interactorComponents;		// list of required components for the 'interactor'
 	Array<uint32> interacteeComponents;		// list of required components for the 'interactee'
+	ECSComponentMask interactorMask;		// the same components as masks
+	ECSComponentMask interacteeMask;
 };
 
 
@@ -31,6 +37,7 @@ public:
 	InteractionWorld(ECS &ecsIn);
 
 	virtual void onMakeEntity(EntityHandle handle);
+	virtual void onMakeEntities(const EntityHandle *handles, size_t numHandles);
 	virtual void onRemoveEntity(EntityHandle handle);
 	virtual void onAddComponent(EntityHandle handle, uint32 id);
 	virtual void onRemoveComponent(EntityHandle handle, uint32 id);
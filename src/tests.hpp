@@ -4,4 +4,5 @@ namespace Tests
 {
 	void runTests();
 	void runPerformanceTests();
+	void runECSPerformanceTests();
 };